@@ -5,11 +5,496 @@
 //Each valid input moves the FSM one state forward.
 //If completed successfully, the simulator prints the final state.
 //The optional -d argument before the filenames activates an interactive debugger
-//that allows the user to move the FSM one state at a time
+//that allows the user to move the FSM one state at a time, or run at full
+//speed until a given step or until a breakpoint on a state or input
+//The optional --sessions=N argument runs N independent copies of the FSM,
+//with the inputs dealt out to the sessions in turn, on --workers=W threads.
+//In sessions mode, sending SIGHUP reloads the definition file without
+//stopping, with the same --profile and --layout renumbering (a file that
+//can't be read is skipped with a warning); --reload-policy=restart|stop
+//says what happens to sessions whose current state no longer exists
+//The optional --nfa argument treats the definition as nondeterministic:
+//every matching transition is followed, state:>next lines are epsilon
+//transitions, and the simulator prints the set of states it ends in.
+//--dfa-cache=MB runs the NFA through a lazily built DFA of at most MB
+//megabytes instead of simulating the state set directly
+//The optional --compress argument runs on a compressed table that stores
+//one default next state per state plus only the transitions that differ,
+//or on the dense table if that would be smaller
+//The optional --profile=N argument runs the first N inputs to find the hot
+//states, and renumbers the compiled table so they sit next to each other;
+//--layout=FILE saves that order, or loads it when there is no --profile
+//The optional --stream argument runs the inputs file without loading it:
+//a reader thread reads ahead into a ring of buffers while the FSM runs
+//The optional --jobs=N argument loads the definition file on N threads and
+//reports repeated and conflicting transitions for the same state and input
+//The optional --fuzz=N argument checks every engine against moveOne's
+//linear scan on N random machines and inputs (--seed=S picks them)
+//The optional --emit or --emit=FILE argument runs the FSM as a transducer
+//and writes its output to stdout or FILE. Transitions can have an output,
+//as in state:input>next/output, and states can have one that is written
+//each time they are entered, as in state/output. Outputs can use \n, \t,
+//\s (space) and \\ for a backslash
+//The optional --all-starts argument prints where the inputs end from every
+//state, and --start=S runs them from state S instead of 0. Both find the
+//result for every start state in one pass over the inputs, which
+//--summary-cache=DIR saves and reuses for the same inputs and definition
+//The optional --stats argument prints the memory used by each structure
+//of the run, and --narrow runs on a table whose entries are as narrow as
+//the number of states allows (1, 2 or 4 bytes)
+//The optional --regex=PATTERN argument replaces the definition file with a
+//machine that accepts the inputs that match PATTERN; then only the inputs
+//file is given. It can be repeated, and written as --regex=TAG=PATTERN to
+//report which pattern the inputs match (the first one given wins).
+//Patterns use . [a-z] [^...] \d \w ( ) | * + ? and \ to escape.
+//--emit-def=FILE writes the machine as a definition file instead, where
+//accepting states of tagged patterns have the output TAG, for --emit
+//The optional --realtime argument feeds the inputs one event at a time
+//through a step function with a fixed cost per event, and prints the
+//p50, p99 and p99.9 latency of the steps
+//The optional --trace=FILE argument runs the FSM without printing each step
+//and records every step in a compact binary trace, which --replay=FILE opens
+//in a debugger that can step forward and backward and jump to any step
+//Only one of -d, --sessions, --nfa, --compress, --trace, --replay, --emit,
+//--emit-def, --stream, --all-starts or --start, --realtime, --narrow,
+//--fuzz and --bench can be given
+//
+//compile with: gcc -O2 -pthread systemsFinalProject.c -o systemsFinalProject
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//result codes for runs that report errors instead of exiting
+#define RUN_OK 0
+#define RUN_INVALID_INPUT 1
+#define RUN_DEAD_END 2
+#define RUN_STATE_REMOVED 3
+#define RUN_READ_ERROR 4 //a streamed inputs file couldn't be read
+
+//what a reload does with sessions whose state is not in the new definition
+#define RELOAD_RESTART 0 //the session starts over at state 0
+#define RELOAD_STOP 1    //the session stops with RUN_STATE_REMOVED
+
+//simple open-addressing hash map from state ids to dense indices
+typedef struct {
+    int capacity; //always a power of 2
+    int count;
+    int* keys;
+    int* values;
+    char* used;
+} IntMap;
+
+//compiled form of a definition: states are renumbered densely and
+//input chars are mapped to classes, so each step is one table lookup.
+//the table is never modified after compileFSM, so threads can share it
+typedef struct {
+    int numStates;     //number of states in the definition
+    int numClasses;    //number of distinct input chars
+    int dead;          //absorbing state used for missing transitions
+    int start;         //dense index of state 0
+    int* stateIds;     //dense index -> state id from the definition file
+    short classOf[256];         //input char -> class, -1 if invalid input
+    unsigned char classChar[256]; //class -> input char
+    int* next;         //(numStates+1) x numClasses, last row is dead
+    //set when this table replaces another one in a running engine:
+    //maps dense states of remapFrom to dense states of this table
+    const void* remapFrom;
+    int* remap;
+} FSMTable;
+
+//per-session state, owned by exactly one worker
+typedef struct {
+    int state;
+    int status;        //RUN_OK, or the error that stopped this session
+    char badInput;     //input that caused the error
+    int stateId;       //state id when the error happened
+    long long steps;
+} SessionSlot;
+
+//one cell of an event queue, see queuePush
+typedef struct {
+    _Atomic size_t seq;
+    uint64_t value;
+} QueueCell;
+
+//bounded lock-free multi-producer single-consumer event queue
+typedef struct {
+    QueueCell* cells;
+    size_t mask;
+    char pad1[64]; //keep producer and consumer indices on separate lines
+    _Atomic size_t tail; //shared by producers
+    char pad2[64];
+    size_t head; //only touched by the consumer
+    char pad3[64];
+} EventQueue;
+
+struct SessionEngine;
+
+//a worker thread with its own queue and its own pinned sessions
+typedef struct {
+    pthread_t thread;
+    EventQueue queue;
+    struct SessionEngine* engine;
+    int numSlots;
+    SessionSlot* slots;
+    const FSMTable* table;  //table the slots' states refer to
+    _Atomic(const FSMTable*) inUse; //published copy of table for reloads
+    _Atomic long long posted;
+    _Atomic long long processed;
+} Worker;
+
+//runs many sessions of one shared FSM, sharded over worker threads
+typedef struct SessionEngine {
+    _Atomic(const FSMTable*) table; //replaced by sessionEngineReload
+    int numSessions;
+    int numWorkers;
+    int* sessionWorker; //session -> worker it is pinned to
+    int* sessionSlot;   //session -> slot index within that worker
+    Worker* workers;
+} SessionEngine;
+
+//events are packed as session << 8 | input
+#define EVENT_STOP UINT64_MAX
+#define QUEUE_SIZE 65536
+#define WORKER_BATCH 256
+
+//trace files start with a header, then hold one record per step:
+//the input byte, then the change in state id as a zigzag varint.
+//after the records comes the index (one entry every interval steps)
+//and a footer saying where the index is
+#define TRACE_MAGIC "FSMTRC1"
+#define TRACE_INTERVAL 1024
+#define TRACE_BUFFER (1 << 20)
+
+typedef struct {
+    char magic[8];
+    uint32_t interval;
+    int32_t startState;
+} TraceHeader;
+
+//state before step k*interval, and the offset of that step's record
+typedef struct {
+    uint64_t offset;
+    int32_t state;
+    int32_t pad;
+} TraceIndexEntry;
+
+typedef struct {
+    uint64_t steps;
+    uint64_t indexOffset;
+    uint64_t indexCount;
+    int32_t status;  //RUN_OK, or the error that ended the run
+    int32_t badInput;
+    char magic[8];
+} TraceFooter;
+
+//records steps into one buffer while a background thread writes the other
+typedef struct {
+    FILE* file;
+    unsigned char* buffers[2];
+    int filling;          //which buffer steps are being recorded into
+    size_t used;          //bytes used in that buffer
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned char* pending; //full buffer waiting for the writer thread
+    size_t pendingSize;
+    int done;
+    uint64_t offset;      //file offset of the next record
+    uint64_t steps;
+    int lastState;
+    TraceIndexEntry* index;
+    uint64_t indexCount;
+    uint64_t indexCapacity;
+    int error;            //errno of the first failed write, 0 if none
+} TraceWriter;
+
+//a trace file mapped into memory for replay
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    const TraceHeader* header;
+    const TraceFooter* footer;
+    const TraceIndexEntry* index;
+} TraceReader;
+
+//position in a trace: the state after step steps
+typedef struct {
+    uint64_t step;
+    int state;
+    uint64_t offset;   //offset of the next record
+    char input;        //input of the last step taken
+    int prevState;     //state before the last step taken
+} TraceCursor;
+
+//compressed form of an FSMTable, packed the way lexer generators pack
+//their tables. each state has a default next state, and its other
+//transitions are stored in next/check starting at base[state]: entry
+//base[state]+class belongs to the state only if check says so
+typedef struct {
+    int numStates;
+    int numClasses;
+    int dead;
+    int start;
+    int* stateIds;
+    short classOf[256];
+    unsigned char classChar[256];
+    int* base;       //numStates+1 entries, one per state and the dead state
+    int* defaults;   //numStates+1 entries
+    int* next;       //size entries shared by all states
+    int* check;      //owner of each entry in next, -1 if unused
+    int size;
+} CombTable;
+
+//candidate bases tried for each row of a comb table before it is
+//placed after all the others
+#define COMB_SEARCH_LIMIT 1024
+
+//FSMTable with next states stored in the narrowest type that holds every
+//dense state, dead included: uint8_t, uint16_t or uint32_t
+typedef struct {
+    int numStates;
+    int numClasses;
+    int dead;
+    int start;
+    int width;       //bytes per entry
+    int* stateIds;
+    short classOf[256];
+    unsigned char classChar[256];
+    void* next;      //(numStates+1) x numClasses entries of width bytes
+} NarrowTable;
+
+//inputs file read ahead by a background thread into a ring of buffers.
+//chunk k goes into buffer k % STREAM_BUFFERS, so the reader can be up to
+//STREAM_BUFFERS chunks ahead of the FSM
+#define STREAM_CHUNK (4 << 20)
+#define STREAM_BUFFERS 4
+
+typedef struct {
+    int fd;
+    char* buffers[STREAM_BUFFERS];
+    size_t sizes[STREAM_BUFFERS];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    long long produced; //chunks read so far
+    long long consumed; //chunks the FSM is done with
+    int eof;
+    int stop;           //set to make the reader give up early
+    int error;          //errno of a failed read, 0 if none
+} InputStream;
+
+//one thread's share of a parallel definition load
+typedef struct {
+    pthread_t thread;
+    const char* begin;    //chunk of the mapped file, split between tokens
+    const char* end;
+    int count;            //transitions parsed from the chunk
+    int capacity;
+    int* curStateList;
+    char* inputList;
+    int* nextStateList;
+    int syntaxError;      //set if a line in the chunk didn't parse
+    int offset;           //where the chunk's transitions go in the result
+    //arrays to merge into, and the duplicate check
+    int length;
+    int* allCurStates;
+    char* allInputs;
+    int* allNextStates;
+    int part;             //this thread checks keys with hash % parts == part
+    int parts;
+    int* repeats;         //pairs of (transition, earlier transition)
+    int numRepeats;
+} LoadJob;
+
+//where a transition's output is in a transducer's string pool
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} OutputRef;
+
+//an FSM with an output for every transition. state outputs (Moore) are
+//added to the outputs of the transitions that enter the state, so the
+//executor only has transition outputs (Mealy)
+typedef struct {
+    FSMTable* table;
+    OutputRef* outputs;  //one per table cell
+    OutputRef startOutput; //output of the start state, written first
+    char* pool;          //all outputs, back to back
+    size_t poolSize;
+} Transducer;
+
+//collects outputs and writes them with one writev call per batch.
+//short outputs are copied into a staging buffer; longer ones are written
+//straight from the transducer's pool without copying
+#define OUTPUT_IOVECS 1024
+#define OUTPUT_STAGING (1 << 20)
+#define OUTPUT_COPY_LIMIT 64
+
+typedef struct {
+    int fd;
+    struct iovec iov[OUTPUT_IOVECS];
+    int count;
+    char* staging;
+    size_t used;
+    size_t segmentStart; //staging bytes before this are already in iov
+    long long bytes;     //bytes written so far
+    int error;           //errno of the first failed write, 0 if none
+} OutputBuffer;
+
+//what a sequence of inputs does from every start state: for each dense
+//start state, the state the run ends in (the state before the error, if
+//there is one), the number of steps taken and the error
+typedef struct {
+    int numStates;
+    long long length;      //number of inputs summarized
+    int32_t* finalState;
+    int64_t* steps;
+    unsigned char* status;
+} InputSummary;
+
+//runs from different starts that reach the same state are merged every
+//SUMMARY_MERGE steps
+#define SUMMARY_MERGE 64
+
+//summary cache files hold this header, then the three arrays
+#define SUMMARY_MAGIC "FSMSUM1"
+
+typedef struct {
+    char magic[8];
+    uint64_t tableHash;
+    uint64_t inputHash;
+    int64_t length;
+    int32_t numStates;
+    int32_t pad;
+} SummaryHeader;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+//a Thompson NFA node built from a regex. REGEX_CHARS nodes move to out on
+//any char in chars, REGEX_SPLIT nodes have epsilon edges to out and out1,
+//REGEX_EMPTY nodes have one to out, and REGEX_MATCH nodes accept pattern tag
+#define REGEX_CHARS 0
+#define REGEX_SPLIT 1
+#define REGEX_EMPTY 2
+#define REGEX_MATCH 3
+#define REGEX_MAX_PATTERNS 64
+#define REGEX_MAX_STATES 65536
+
+typedef struct {
+    int type;
+    int out;
+    int out1;
+    int tag;
+    uint64_t chars[2];  //bit c is set if the node moves on char c
+} RegexNode;
+
+//minimized DFA for a set of patterns. state 0 is the start state
+typedef struct {
+    int numStates;
+    int numClasses;
+    short classOf[128];  //-1 for chars no pattern uses
+    int* next;           //numStates x numClasses, -1 if no pattern can go on
+    int* tag;            //pattern the state accepts, -1 if none
+} RegexDFA;
+
+//one run of an FSM driven one event at a time. realtimeInit does all the
+//setup, so realtimeStep always costs a class lookup and a table lookup:
+//no allocation, no I/O, no exit. once a step fails the run stays stopped
+typedef struct {
+    const FSMTable* table;
+    int state;
+    int status;
+    char badInput;
+    long long steps;
+    int locked;   //set if realtimeInit locked the table in memory
+} RealtimeRun;
+
+//epsilon transitions are stored with this input char
+#define EPSILON '\0'
+
+//an NFA compiled for bitset simulation. a set of states is words 64-bit
+//words; succ holds, for each input class and state, the set of states
+//reachable by that input followed by any number of epsilon transitions
+typedef struct {
+    int numStates;
+    int numClasses;
+    int words;
+    int* stateIds;
+    short classOf[256];
+    unsigned char classChar[256];
+    uint64_t* startSet; //epsilon closure of state 0
+    uint64_t* succ;     //numClasses x numStates x words
+} NFATable;
+
+//DFA states built on demand from the NFA's state sets. when the cache
+//would grow past maxStates it is flushed and rebuilt from the current set
+typedef struct {
+    const NFATable* nfa;
+    int maxStates;
+    int count;
+    int capacity;
+    uint64_t* sets;     //capacity x words, the NFA set of each DFA state
+    int* next;          //capacity x numClasses, -1 if not built yet
+    int* hash;          //open addressing table of DFA states, -1 if empty
+    int hashCapacity;
+    uint64_t* scratch;  //2 x words
+    long long flushes;
+} LazyDFA;
+
+//command line options
+typedef struct {
+    int debug;
+    int sessions;
+    int workers;
+    int reloadPolicy;
+    const char* bench;
+    const char* trace;
+    const char* replay;
+    int nfa;
+    int dfaCacheMB;
+    int compress;
+    long long profile;
+    const char* layout;
+    int stream;
+    int jobs;
+    int fuzz;
+    unsigned long long seed;
+    const char* emit;    //"-" for stdout
+    int allStarts;
+    int hasStart;
+    int start;
+    const char* summaryCache;
+    int stats;
+    int narrow;
+    int numRegexes;
+    const char* regexTags[REGEX_MAX_PATTERNS]; //NULL for untagged patterns
+    const char* regexes[REGEX_MAX_PATTERNS];
+    const char* emitDef;
+    int realtime;
+} Options;
 
 int getLength(char* file);
 void storeData(int length, char* file,
@@ -23,7 +508,148 @@ void debugger(int length, int* curStateList, char* inputList, int* nextStateList
               int length2, char* inputOrder);
 int moveOne(int length, int* curStateList, char* inputList, int* nextStateList,
             char* inputOrder, int curState, int step, int test);
+int scanStep(int length, int* curStateList, char* inputList, int* nextStateList,
+             char nextInput, int curState, int* status);
 int test();
+int memoryFile(char* path, size_t size);
+
+void intMapInit(IntMap* map, int expected);
+int intMapGet(const IntMap* map, int key);
+void intMapPut(IntMap* map, int key, int value);
+void intMapFree(IntMap* map);
+FSMTable* compileFSM(int length, int* curStateList, char* inputList,
+                     int* nextStateList);
+void freeFSMTable(FSMTable* table);
+int runTable(const FSMTable* table, const char* inputOrder, long long length2,
+             int startState, long long* step, int* status);
+unsigned long long rngNext(unsigned long long* seed);
+void generateFSM(int numStates, int numInputs, unsigned long long seed,
+                 int* curStateList, char* inputList, int* nextStateList);
+void queueInit(EventQueue* queue, size_t size);
+int queuePush(EventQueue* queue, uint64_t value);
+int queuePop(EventQueue* queue, uint64_t* value);
+void queueFree(EventQueue* queue);
+SessionEngine* sessionEngineCreate(const FSMTable* table, int numSessions,
+                                   int numWorkers);
+void sessionEngineStart(SessionEngine* engine);
+void sessionEnginePost(SessionEngine* engine, int session, char input);
+void sessionEngineDrain(SessionEngine* engine);
+void sessionEngineFinish(SessionEngine* engine);
+FSMTable* sessionEngineReload(SessionEngine* engine, FSMTable* table, int policy);
+const SessionSlot* sessionEngineSlot(const SessionEngine* engine, int session);
+void sessionEngineFree(SessionEngine* engine);
+void runSessions(const Options* options, char* file1, int length,
+                 int* curStateList, char* inputList, int* nextStateList,
+                 int length2, char* inputOrder);
+FSMTable* loadFSM(const Options* options, char* file, int length2,
+                  char* inputOrder);
+void benchSessions();
+double seconds();
+int nextThreadCount(int threads, int cores);
+CombTable* compressFSM(const FSMTable* table);
+void freeCombTable(CombTable* comb);
+size_t combBytes(const CombTable* comb);
+size_t tableBytes(const FSMTable* table);
+int runComb(const CombTable* comb, const char* inputOrder, long long length2,
+            int startState, long long* step, int* status);
+void benchCompress();
+int* profileLayout(const FSMTable* table, const char* sample, long long length);
+FSMTable* permuteFSM(const FSMTable* table, const int* order);
+int* readLayout(const FSMTable* table, const char* file);
+void writeLayout(const FSMTable* table, const int* order, const char* file);
+FSMTable* buildTable(const Options* options, int length, int* curStateList,
+                     char* inputList, int* nextStateList,
+                     int length2, char* inputOrder);
+void benchLayout();
+InputStream* streamOpen(const char* file);
+InputStream* streamOpenFd(int fd);
+int streamNext(InputStream* stream, const char** data, size_t* size);
+void streamRelease(InputStream* stream);
+void streamClose(InputStream* stream);
+int runStream(const FSMTable* table, InputStream* stream, long long* step,
+              int* status, char* badInput);
+void benchStream();
+int parseTransition(const char* p, const char* end, int* curState, char* input,
+                    int* nextState);
+int loadParallel(char* file, int jobs, int reportConflicts, int** curStateList,
+                 char** inputList, int** nextStateList);
+void benchLoad();
+int fuzzEngines(int cases, unsigned long long seed, int verbose);
+Transducer* parseTransducer(const char* data, size_t size);
+Transducer* loadTransducer(char* file);
+void freeTransducer(Transducer* transducer);
+void outputInit(OutputBuffer* out, int fd);
+void outputWrite(OutputBuffer* out, const char* data, size_t size);
+void outputFlush(OutputBuffer* out);
+int runTransducer(const Transducer* transducer, const char* inputOrder,
+                  long long length2, OutputBuffer* out, long long* step,
+                  int* status);
+void benchEmit();
+uint64_t fnvHash(uint64_t hash, const void* data, size_t size);
+uint64_t hashTable(const FSMTable* table);
+InputSummary* summarizeInputs(const FSMTable* table, const char* inputOrder,
+                              long long length2);
+int summaryLookup(const InputSummary* summary, int startState, long long* step,
+                  int* status);
+void freeSummary(InputSummary* summary);
+InputSummary* readSummary(const char* file, uint64_t tableHash, uint64_t inputHash);
+void writeSummary(const InputSummary* summary, const char* file,
+                  uint64_t tableHash, uint64_t inputHash);
+void runSummarized(const Options* options, FSMTable* table, char* inputOrder,
+                   int length2);
+void benchSummary();
+int narrowWidth(const FSMTable* table);
+NarrowTable* narrowFSM(const FSMTable* table, int width);
+void freeNarrowTable(NarrowTable* narrow);
+size_t narrowBytes(const NarrowTable* narrow);
+int runNarrow(const NarrowTable* narrow, const char* inputOrder, long long length2,
+              int startState, long long* step, int* status);
+void printStats(int length, long long length2, const FSMTable* table,
+                const CombTable* comb);
+void benchNarrow();
+RegexDFA* compileRegexes(int count, const char** patterns, const char** error);
+void freeRegexDFA(RegexDFA* dfa);
+int regexTransitions(const RegexDFA* dfa, int** curStateList, char** inputList,
+                     int** nextStateList);
+char* regexDefinition(const RegexDFA* dfa, const char** tags, size_t* size);
+void realtimeInit(RealtimeRun* run, const FSMTable* table, int lock);
+int realtimeStep(RealtimeRun* run, char input);
+void realtimeFree(RealtimeRun* run);
+uint64_t latencyTicks();
+double latencyTicksPerNs();
+void printLatencies(const char* name, uint64_t* ticks, long long count,
+                    double ticksPerNs);
+void benchLatency();
+NFATable* compileNFA(int length, int* curStateList, char* inputList,
+                     int* nextStateList);
+void freeNFATable(NFATable* nfa);
+int runNFA(const NFATable* nfa, const char* inputOrder, long long length2,
+           uint64_t* set, long long* step, int* status);
+void lazyDFAInit(LazyDFA* dfa, const NFATable* nfa, size_t maxBytes);
+int lazyDFAStart(LazyDFA* dfa);
+int lazyDFAStep(LazyDFA* dfa, int* state, int cls);
+int runLazyDFA(LazyDFA* dfa, const char* inputOrder, long long length2,
+               int state, long long* step, int* status);
+void lazyDFAFree(LazyDFA* dfa);
+void printStateSet(const NFATable* nfa, const uint64_t* set);
+void runNondeterministic(const Options* options, int length, int* curStateList,
+                         char* inputList, int* nextStateList,
+                         int length2, char* inputOrder);
+int runToBreak(const FSMTable* table, const char* inputOrder, int length2,
+               int* curState, int* step, int stopStep, const char* stateBreak,
+               const char* inputBreak, int* status);
+void printRunResult(const FSMTable* table, int curState, long long step,
+                    int status, char input);
+TraceWriter* traceCreate(const char* file, int startState);
+void traceRecord(TraceWriter* writer, char input, int state);
+int traceClose(TraceWriter* writer, int status, char badInput);
+int runTraced(const FSMTable* table, const char* inputOrder, long long length2,
+              TraceWriter* writer, long long* step, int* status);
+int traceOpen(TraceReader* reader, const char* file);
+void traceCloseReader(TraceReader* reader);
+void traceSeek(const TraceReader* reader, TraceCursor* cursor, uint64_t step);
+int traceNext(const TraceReader* reader, TraceCursor* cursor);
+void replayDebugger(const char* file);
 
 int main(int argc, char *argv[]) {
 
@@ -43,51 +669,527 @@ int main(int argc, char *argv[]) {
         exit(0);
     }
 
-    //if the first argument is -d, activate debugger
-    int debug = (!strcmp(argv[1],"-d"));
+    //read options until the first filename
+    Options options = {0};
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-'){
+        if (!strcmp(argv[argi], "-d")){
+            options.debug = 1; //activate debugger
+        }
+        else if (!strncmp(argv[argi], "--sessions=", 11)){
+            options.sessions = atoi(argv[argi] + 11);
+        }
+        else if (!strncmp(argv[argi], "--workers=", 10)){
+            options.workers = atoi(argv[argi] + 10);
+        }
+        else if (!strcmp(argv[argi], "--reload-policy=restart")){
+            options.reloadPolicy = RELOAD_RESTART;
+        }
+        else if (!strcmp(argv[argi], "--reload-policy=stop")){
+            options.reloadPolicy = RELOAD_STOP;
+        }
+        else if (!strncmp(argv[argi], "--bench=", 8)){
+            options.bench = argv[argi] + 8;
+        }
+        else if (!strncmp(argv[argi], "--trace=", 8)){
+            options.trace = argv[argi] + 8;
+        }
+        else if (!strncmp(argv[argi], "--replay=", 9)){
+            options.replay = argv[argi] + 9;
+        }
+        else if (!strcmp(argv[argi], "--compress")){
+            options.compress = 1;
+        }
+        else if (!strncmp(argv[argi], "--profile=", 10)){
+            options.profile = atoll(argv[argi] + 10);
+        }
+        else if (!strncmp(argv[argi], "--layout=", 9)){
+            options.layout = argv[argi] + 9;
+        }
+        else if (!strcmp(argv[argi], "--stream")){
+            options.stream = 1;
+        }
+        else if (!strncmp(argv[argi], "--jobs=", 7)){
+            options.jobs = atoi(argv[argi] + 7);
+        }
+        else if (!strncmp(argv[argi], "--fuzz=", 7)){
+            options.fuzz = atoi(argv[argi] + 7);
+        }
+        else if (!strncmp(argv[argi], "--seed=", 7)){
+            options.seed = strtoull(argv[argi] + 7, NULL, 10);
+        }
+        else if (!strcmp(argv[argi], "--emit")){
+            options.emit = "-";
+        }
+        else if (!strncmp(argv[argi], "--emit=", 7)){
+            options.emit = argv[argi] + 7;
+        }
+        else if (!strcmp(argv[argi], "--all-starts")){
+            options.allStarts = 1;
+        }
+        else if (!strncmp(argv[argi], "--start=", 8)){
+            options.hasStart = 1;
+            options.start = atoi(argv[argi] + 8);
+        }
+        else if (!strncmp(argv[argi], "--summary-cache=", 16)){
+            options.summaryCache = argv[argi] + 16;
+        }
+        else if (!strcmp(argv[argi], "--realtime")){
+            options.realtime = 1;
+        }
+        else if (!strcmp(argv[argi], "--stats")){
+            options.stats = 1;
+        }
+        else if (!strcmp(argv[argi], "--narrow")){
+            options.narrow = 1;
+        }
+        else if (!strncmp(argv[argi], "--regex=", 8)){
+            if (options.numRegexes == REGEX_MAX_PATTERNS){
+                printf("Error: at most %d patterns\n", REGEX_MAX_PATTERNS);
+                exit(0);
+            }
+            //TAG=PATTERN if it starts with a name and =, else just PATTERN
+            const char* pattern = argv[argi] + 8;
+            const char* name = pattern;
+            while (isalnum((unsigned char)*name) || *name == '_'){
+                name++;
+            }
+            options.regexTags[options.numRegexes] = NULL;
+            if (*name == '=' && name > pattern){
+                *(char*)name = '\0';
+                options.regexTags[options.numRegexes] = pattern;
+                pattern = name + 1;
+            }
+            options.regexes[options.numRegexes++] = pattern;
+        }
+        else if (!strncmp(argv[argi], "--emit-def=", 11)){
+            options.emitDef = argv[argi] + 11;
+        }
+        else if (!strcmp(argv[argi], "--nfa")){
+            options.nfa = 1;
+        }
+        else if (!strncmp(argv[argi], "--dfa-cache=", 12)){
+            options.nfa = 1;
+            options.dfaCacheMB = atoi(argv[argi] + 12);
+        }
+        else{
+            printf("Error: unknown option %s\n", argv[argi]);
+            exit(0);
+        }
+        argi++;
+    }
+
+    //each mode runs the FSM its own way, so at most one can be given
+    const char* modeNames[] = {"--bench", "--fuzz", "--replay", "--emit-def",
+                               "-d", "--sessions", "--nfa or --dfa-cache",
+                               "--compress", "--trace", "--emit", "--stream",
+                               "--all-starts or --start", "--realtime",
+                               "--narrow"};
+    int modeGiven[] = {options.bench != NULL, options.fuzz > 0,
+                       options.replay != NULL, options.emitDef != NULL,
+                       options.debug, options.sessions > 0, options.nfa,
+                       options.compress, options.trace != NULL,
+                       options.emit != NULL, options.stream,
+                       options.allStarts || options.hasStart, options.realtime,
+                       options.narrow};
+    int mode = -1;
+    for (int i = 0; i < (int)(sizeof(modeGiven) / sizeof(modeGiven[0])); i++){
+        if (modeGiven[i] && mode >= 0){
+            printf("Error: %s and %s can't be used together\n",
+                   modeNames[mode], modeNames[i]);
+            exit(0);
+        }
+        if (modeGiven[i]){
+            mode = i;
+        }
+    }
+    //these modes don't run a definition file, so they have nothing to report
+    if (options.stats && mode >= 0 && mode <= 3){
+        printf("Error: --stats can't be used with %s\n", modeNames[mode]);
+        exit(0);
+    }
+    if (options.jobs > 0 && options.emit){
+        printf("Error: --emit loads the definition with its outputs on one "
+               "thread, so it can't be used with --jobs\n");
+        exit(0);
+    }
+
+    //benchmarks generate their own machines and need no files
+    if (options.bench){
+        if (!strcmp(options.bench, "sessions")){
+            benchSessions();
+        }
+        else if (!strcmp(options.bench, "compress")){
+            benchCompress();
+        }
+        else if (!strcmp(options.bench, "layout")){
+            benchLayout();
+        }
+        else if (!strcmp(options.bench, "stream")){
+            benchStream();
+        }
+        else if (!strcmp(options.bench, "load")){
+            benchLoad();
+        }
+        else if (!strcmp(options.bench, "emit")){
+            benchEmit();
+        }
+        else if (!strcmp(options.bench, "summary")){
+            benchSummary();
+        }
+        else if (!strcmp(options.bench, "narrow")){
+            benchNarrow();
+        }
+        else if (!strcmp(options.bench, "latency")){
+            benchLatency();
+        }
+        else{
+            printf("Error: unknown benchmark %s\n", options.bench);
+        }
+        exit(0);
+    }
+
+    //fuzzing generates its own machines and needs no files
+    if (options.fuzz > 0){
+        unsigned long long seed = options.seed ? options.seed : (unsigned long long)time(NULL);
+        printf("fuzzing %d cases with --seed=%llu\n", options.fuzz, seed);
+        if (!fuzzEngines(options.fuzz, seed, 1)){
+            printf("all engines agree with moveOne on %d cases\n", options.fuzz);
+        }
+        exit(0);
+    }
+
+    //replaying a trace needs only the trace file
+    if (options.replay){
+        replayDebugger(options.replay);
+        exit(0);
+    }
+
+    //patterns are compiled into the definition, which can be written out
+    RegexDFA* regex = NULL;
+    char* regexText = NULL;
+    size_t regexTextSize = 0;
+    if (options.numRegexes > 0){
+        const char* error;
+        double begin = seconds();
+        regex = compileRegexes(options.numRegexes, options.regexes, &error);
+        if (!regex){
+            printf("Error in pattern: %s\n", error);
+            exit(0);
+        }
+        regexText = regexDefinition(regex, options.regexTags, &regexTextSize);
+        printf("compiled %d pattern%s into %d states in %.1f ms\n",
+               options.numRegexes, options.numRegexes == 1 ? "" : "s",
+               regex->numStates, (seconds() - begin) * 1e3);
+        if (options.emitDef){
+            FILE* def = fopen(options.emitDef, "w");
+            if (!def){
+                printf("Error writing definition file\n");
+                exit(0);
+            }
+            fwrite(regexText, 1, regexTextSize, def);
+            fclose(def);
+            printf("wrote definition file %s\n", options.emitDef);
+            free(regexText);
+            freeRegexDFA(regex);
+            exit(0);
+        }
+        if (options.sessions > 0){
+            printf("Error: --sessions reloads the definition file, so it "
+                   "can't be used with --regex\n");
+            exit(0);
+        }
+    }
 
     //if too few arguments were provided, print an error message
-    //for debugger, must have 3 args, and otherwise must have 2
-    if ((debug && argc<4)||(!debug && argc<3)){
+    //after the options there must be exactly 2 filenames, or just the
+    //inputs file if the definition comes from patterns
+    int numFiles = regex ? 1 : 2;
+    if (argc - argi < numFiles){
         printf("Error: too few arguments\n");
         exit(0);
     }
 
     //if too many arguments, print error message
-    //if debugger has a 4th arg or regular has a 3rd, there are too many
-    if ((debug && argc>4)||(!debug && argc>3)){
+    if (argc - argi > numFiles){
         printf("Error: too many arguments\n");
         exit(0);
     }
 
-    //if debugging mode, files are args 2 and 3
-    //if not, files are args 1 and 2
-    char* file1 = debug ? argv[2]: argv[1];
-    char* file2 = debug ? argv[3]: argv[2];
+    char* file1 = regex ? NULL : argv[argi];
+    char* file2 = argv[argi + numFiles - 1];
+
+    //if emitting, load the definition with its outputs and run it as a
+    //transducer
+    if (options.emit){
+        Transducer* transducer = regex ? parseTransducer(regexText, regexTextSize)
+                                       : loadTransducer(file1);
+        int length2 = getInputLength(file2);
+        char* inputOrder = malloc(length2 ? length2 : 1);
+        storeInputData(length2, file2, inputOrder);
+        int fd = 1;
+        if (strcmp(options.emit, "-")){
+            fd = open(options.emit, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0){
+                printf("Error writing output file\n");
+                exit(0);
+            }
+        }
+        OutputBuffer out;
+        outputInit(&out, fd);
+        fflush(stdout); //keep messages and output in order
+        long long step;
+        int status;
+        int curState = runTransducer(transducer, inputOrder, length2, &out,
+                                     &step, &status);
+        outputFlush(&out);
+        if (fd != 1 && close(fd) != 0 && !out.error){
+            out.error = errno;
+        }
+        printRunResult(transducer->table, curState, step, status,
+                       step < length2 ? inputOrder[step] : 0);
+        if (options.stats){
+            printStats(-1, length2, transducer->table, NULL);
+        }
+        if (out.error){
+            printf("Error writing output after %lld bytes: %s\n", out.bytes,
+                   strerror(out.error));
+            exit(1);
+        }
+        printf("wrote %lld bytes of output\n", out.bytes);
+        free(out.staging);
+        free(inputOrder);
+        freeTransducer(transducer);
+        free(regexText);
+        if (regex){
+            freeRegexDFA(regex);
+        }
+        exit(0);
+    }
+
+    int length;
+    int* curStateList;
+    char* inputList;
+    int* nextStateList;
+    if (regex){
+        length = regexTransitions(regex, &curStateList, &inputList, &nextStateList);
+    }
+    //if loading in parallel, parse the whole file at once on jobs threads
+    else if (options.jobs > 0){
+        length = loadParallel(file1, options.jobs, !options.nfa,
+                              &curStateList, &inputList, &nextStateList);
+    }
+    else{
+        //read through def file and get length
+        length = getLength(file1);
+        //initialize storage arrays to the size of length.
+        //they are on the heap so long files don't overflow the stack
+        curStateList = malloc(sizeof(int) * (length ? length : 1));
+        inputList = malloc(length ? length : 1);
+        nextStateList = malloc(sizeof(int) * (length ? length : 1));
+        //read through def again and store the def data in arrays
+        storeData(length, file1, curStateList, inputList, nextStateList);
+    }
 
-    //read through def file and get length
-    int length = getLength(file1);
-    //initialize storage arrays to the size of length
-    int curStateList[length];
-    char inputList[length];
-    int nextStateList[length];
-    //read through def again and store the def data in arrays
-    storeData(length, file1, curStateList, inputList, nextStateList);
+    //if streaming, run the inputs file as it is read instead of storing it
+    if (options.stream){
+        if (options.profile > 0){
+            printf("Error: --profile runs the stored inputs, so it can't be "
+                   "used with --stream\n");
+            exit(0);
+        }
+        FSMTable* table = buildTable(&options, length, curStateList, inputList,
+                                     nextStateList, 0, NULL);
+        //the inputs only ever take up the stream's buffers
+        if (options.stats){
+            printStats(length, (long long)STREAM_BUFFERS * STREAM_CHUNK, table,
+                       NULL);
+        }
+        InputStream* stream = streamOpen(file2);
+        if (!stream){
+            printf("Error reading input file\n");
+            exit(0);
+        }
+        printf("processing FSM inputs file %s\n", file2);
+        long long step;
+        int status;
+        char badInput;
+        int curState = runStream(table, stream, &step, &status, &badInput);
+        streamClose(stream);
+        printRunResult(table, curState, step, status, badInput);
+        freeFSMTable(table);
+        exit(0);
+    }
 
     //read through input file and get length
     int length2 = getInputLength(file2);
     //initialize input storage array
-    char inputOrder[length2];
+    char* inputOrder = malloc(length2 ? length2 : 1);
     //store input data in array
     storeInputData(length2, file2, inputOrder);
 
+    //if asked about other start states, summarize the inputs from all of them
+    if (options.allStarts || options.hasStart){
+        FSMTable* table = buildTable(&options, length, curStateList, inputList,
+                                     nextStateList, length2, inputOrder);
+        if (options.stats){
+            printStats(length, length2, table, NULL);
+        }
+        runSummarized(&options, table, inputOrder, length2);
+        freeFSMTable(table);
+    }
+
+    //if real-time mode, time each step of an event at a time run
+    else if (options.realtime){
+        FSMTable* table = buildTable(&options, length, curStateList, inputList,
+                                     nextStateList, length2, inputOrder);
+        if (options.stats){
+            printStats(length, length2, table, NULL);
+        }
+        RealtimeRun run;
+        realtimeInit(&run, table, 1);
+        uint64_t* ticks = malloc(sizeof(uint64_t) * (length2 ? length2 : 1));
+        long long count = 0;
+        for (int i = 0; i < length2 && run.status == RUN_OK; i++){
+            uint64_t begin = latencyTicks();
+            realtimeStep(&run, inputOrder[i]);
+            ticks[count++] = latencyTicks() - begin;
+        }
+        printRunResult(table, run.state, run.steps, run.status, run.badInput);
+        printLatencies("step latency", ticks, count, latencyTicksPerNs());
+        free(ticks);
+        realtimeFree(&run);
+        freeFSMTable(table);
+    }
+
+    //if narrowing, run on the narrowest table
+    else if (options.narrow){
+        FSMTable* table = buildTable(&options, length, curStateList, inputList,
+                                     nextStateList, length2, inputOrder);
+        if (options.stats){
+            printStats(length, length2, table, NULL);
+        }
+        NarrowTable* narrow = narrowFSM(table, 0);
+        long long step;
+        int status;
+        int curState = runNarrow(narrow, inputOrder, length2, narrow->start,
+                                 &step, &status);
+        printRunResult(table, curState, step, status,
+                       step < length2 ? inputOrder[step] : 0);
+        freeNarrowTable(narrow);
+        freeFSMTable(table);
+    }
+
+    //if sessions mode, run the inputs through many copies of the FSM
+    else if (options.sessions > 0){
+        runSessions(&options, file1, length, curStateList, inputList,
+                    nextStateList, length2, inputOrder);
+    }
+
+    //if the FSM is nondeterministic, follow every matching transition
+    else if (options.nfa){
+        if (options.stats){
+            printStats(length, length2, NULL, NULL);
+        }
+        runNondeterministic(&options, length, curStateList, inputList,
+                            nextStateList, length2, inputOrder);
+    }
+
+    //if compressing, run on the default/exception table
+    else if (options.compress){
+        FSMTable* table = buildTable(&options, length, curStateList, inputList,
+                                     nextStateList, length2, inputOrder);
+        CombTable* comb = compressFSM(table);
+        printf("compressed table uses %zu bytes, dense table %zu bytes\n",
+               combBytes(comb), tableBytes(table));
+        if (options.stats){
+            printStats(length, length2, table, comb);
+        }
+        long long step;
+        int status;
+        int curState;
+        //most rows differ in most inputs, so packing doesn't pay
+        if (combBytes(comb) >= tableBytes(table)){
+            printf("compression doesn't help this machine, running the "
+                   "dense table\n");
+            curState = runTable(table, inputOrder, length2, table->start,
+                                &step, &status);
+        }
+        else{
+            curState = runComb(comb, inputOrder, length2, comb->start,
+                               &step, &status);
+        }
+        printRunResult(table, curState, step, status,
+                       step < length2 ? inputOrder[step] : 0);
+        freeCombTable(comb);
+        freeFSMTable(table);
+    }
+
+    //if tracing, run on the compiled table and record every step
+    else if (options.trace){
+        FSMTable* table = buildTable(&options, length, curStateList, inputList,
+                                     nextStateList, length2, inputOrder);
+        if (options.stats){
+            printStats(length, length2, table, NULL);
+        }
+        TraceWriter* writer = traceCreate(options.trace,
+                                          table->stateIds[table->start]);
+        long long step;
+        int status;
+        int curState = runTraced(table, inputOrder, length2, writer,
+                                 &step, &status);
+        char lastInput = step < length2 ? inputOrder[step] : 0;
+        int error = traceClose(writer, status, lastInput);
+        printRunResult(table, curState, step, status, lastInput);
+        freeFSMTable(table);
+        if (error){
+            printf("Error writing trace file %s: %s\n", options.trace,
+                   strerror(error));
+            exit(1);
+        }
+    }
+
+    //if the machine came from patterns, say which one the inputs match
+    else if (regex && !options.debug){
+        FSMTable* table = buildTable(&options, length, curStateList, inputList,
+                                     nextStateList, length2, inputOrder);
+        if (options.stats){
+            printStats(length, length2, table, NULL);
+        }
+        long long step;
+        int status;
+        int curState = runTable(table, inputOrder, length2, table->start,
+                                &step, &status);
+        printRunResult(table, curState, step, status,
+                       step < length2 ? inputOrder[step] : 0);
+        int tag = status == RUN_OK ? regex->tag[table->stateIds[curState]] : -1;
+        if (tag < 0){
+            printf("the inputs don't match any pattern\n");
+        }
+        else{
+            printf("the inputs match pattern %s\n", options.regexTags[tag]
+                   ? options.regexTags[tag] : options.regexes[tag]);
+        }
+        freeFSMTable(table);
+        free(regexText);
+        freeRegexDFA(regex);
+    }
+
     //if debugger mode, open debugger
-    if (debug){
+    else if (options.debug){
+        if (options.stats){
+            printStats(length, length2, NULL, NULL);
+        }
         debugger(length, curStateList, inputList, nextStateList, length2, inputOrder);
     }
 
     //otherwise, move through FSM and print final state
-    else {getState(length, curStateList, inputList, nextStateList, length2, inputOrder,0);}
+    else {
+        if (options.stats){
+            printStats(length, length2, NULL, NULL);
+        }
+        getState(length, curStateList, inputList, nextStateList, length2, inputOrder,0);
+    }
 
 }
 
@@ -124,17 +1226,30 @@ void storeData(int length, char* file,
     int var1;
     char var2;
     int var3;
+    char line[64];
+    int used;
 
     //read through def file again
     FILE* def = fopen(file, "r");
 
     //for each line, separate the data into the arrays
     for (int i = 0; i < length; i++) {
+        if (fscanf(def, "%63s", line) != 1) {
+            printf("Error in syntax of definition file\n");
+            exit(0);
+        }
         //make sure all 3 variables are found before processing a line
-        if (fscanf(def, "%d:%c>%d\n", &var1, &var2, &var3) == 3) {
+        if (sscanf(line, "%d:%c>%d", &var1, &var2, &var3) == 3) {
             curStateList[i] = var1;
             inputList[i] = var2;
             nextStateList[i] = var3;
+        }
+        //state:>next is an epsilon transition, only followed in NFA mode
+        else if (sscanf(line, "%d:>%d%n", &var1, &var3, &used) == 2
+                 && line[used] == '\0') {
+            curStateList[i] = var1;
+            inputList[i] = EPSILON;
+            nextStateList[i] = var3;
         }
             //if not 3 variables detected, there is a syntax error
         else{
@@ -143,6 +1258,7 @@ void storeData(int length, char* file,
         }
 
     }
+    fclose(def);
 }
 
 //returns the length of the input file
@@ -206,12 +1322,13 @@ int getState(int length, int* curStateList, char* inputList, int* nextStateList,
 
 }
 
-//checks if input char is in the list of possible inputs
+//checks if input char is in the list of possible inputs.
+//epsilon transitions don't read an input, so they don't count
 int validInput(char input, char* inputList, int length){
     //if the input isn't in the list of possible inputs,
     //it is invalid
     for (int k = 0; k < length; k++){
-        if (inputList[k]==input){
+        if (inputList[k]==input && inputList[k] != EPSILON){
             return 1; //valid: input is in the list
         }
     }
@@ -225,14 +1342,33 @@ void debugger(int length, int* curStateList, char* inputList, int* nextStateList
     //initialize state and step # to 0
     int curState = 0;
     int step = 0;
-    char inputChar;
-    char enter;
+    char line[64];
+
+    //run and continue use the compiled table, and stop at breakpoints
+    FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+    IntMap ids;
+    intMapInit(&ids, table->numStates);
+    for (int i = 0; i < table->numStates; i++){
+        intMapPut(&ids, table->stateIds[i], i);
+    }
+    char* stateBreak = calloc(table->numStates + 1, 1);
+    char inputBreak[256] = {0};
 
     //until you've reached the end of the input file
     while (step < length2) {
         //ask for user input
         printf("FSM debugger>");
-        scanf("%c%c", &inputChar, &enter); //allows for char, newline
+        //when the commands run out, run to the end like c. nothing could
+        //continue from a breakpoint, so they are deleted first
+        if (!fgets(line, sizeof(line), stdin)){
+            printf("\n");
+            memset(stateBreak, 0, table->numStates + 1);
+            memset(inputBreak, 0, sizeof(inputBreak));
+            strcpy(line, "c");
+        }
+        char inputChar = line[0];
+        int number;
+        char breakChar;
 
         //if the user typed p, print current state and definition
         if (inputChar == 'p') {
@@ -252,10 +1388,65 @@ void debugger(int length, int* curStateList, char* inputList, int* nextStateList
             step++;
         }
 
+        //if the user typed b and a state, break when the FSM enters it
+        else if (inputChar == 'b' && sscanf(line + 1, "%d", &number) == 1) {
+            int state = intMapGet(&ids, number);
+            if (state < 0){
+                printf("Error: state %d is not in the FSM\n", number);
+            }
+            else{
+                stateBreak[state] = 1;
+                printf("breakpoint set on state %d\n", number);
+            }
+        }
+
+        //if the user typed i and an input, break before that input is used
+        else if (inputChar == 'i' && sscanf(line + 1, " %c", &breakChar) == 1) {
+            inputBreak[(unsigned char)breakChar] = 1;
+            printf("breakpoint set on input %c\n", breakChar);
+        }
+
+        //if the user typed d, delete all breakpoints
+        else if (inputChar == 'd') {
+            memset(stateBreak, 0, table->numStates + 1);
+            memset(inputBreak, 0, sizeof(inputBreak));
+            printf("all breakpoints deleted\n");
+        }
+
+        //if the user typed r and a step, or c, run without prompting
+        //until that step, a breakpoint or the end of the inputs
+        else if ((inputChar == 'r' && sscanf(line + 1, "%d", &number) == 1)
+                 || inputChar == 'c') {
+            int stopStep = (inputChar == 'r' && number < length2) ? number : length2;
+            int state = intMapGet(&ids, curState);
+            int status;
+            int reason = runToBreak(table, inputOrder, length2, &state, &step,
+                                    stopStep, stateBreak, inputBreak, &status);
+            curState = table->stateIds[state];
+            if (status != RUN_OK){
+                //same as moveOne: report the error and stop
+                printRunResult(table, state, step, status, inputOrder[step]);
+                exit(0);
+            }
+            if (reason == 1){
+                printf("breakpoint: at step %d the FSM entered state %d\n",
+                       step, curState);
+            }
+            else if (reason == 2){
+                printf("breakpoint: at step %d the next input is %c, "
+                       "the FSM is in state %d\n", step, inputOrder[step], curState);
+            }
+            else if (step < length2){
+                printf("at step %d the FSM is in state %d\n", step, curState);
+            }
+        }
+
         //if the user typed anything else, print this prompt
         else{
-            printf("Error: invalid input. Enter p to print current state "
-                   "or n to move one step forward.\n");
+            printf("Error: invalid input. Enter p to print current state, "
+                   "n to move one step forward, r N to run until step N, "
+                   "b S to break on state S, i C to break on input C, "
+                   "d to delete breakpoints or c to continue.\n");
         }
 
     }
@@ -273,40 +1464,77 @@ int moveOne(int length, int* curStateList, char* inputList, int* nextStateList,
 
     //get the next input from the inputs array
     char nextInput = inputOrder[step];
+    int status;
+    int nextState = scanStep(length, curStateList, inputList, nextStateList,
+                             nextInput, curState, &status);
 
     //check if it is a valid input based on the definition file
-    if (!validInput(nextInput, inputList, length)){
+    if (status == RUN_INVALID_INPUT){
         printf("Error: %c is invalid input\n",nextInput);
         exit(0);
     }
 
+    //if there was no match, you've reached a dead end
+    if (status == RUN_DEAD_END){
+        printf("Error detecting state-input match for state:%d input:%c\n",
+               curState, nextInput);
+        exit(0);
+    }
+
+    if (!test) //don't print for tests
+    {printf("at step %d, "
+            "input %c transitions FSM from state %d to state %d\n",
+            step, nextInput, curState, nextState);}
+    return nextState;
+
+}
+
+//the linear scan behind moveOne, reporting errors instead of exiting.
+//this is the reference the faster engines are checked against
+int scanStep(int length, int* curStateList, char* inputList, int* nextStateList,
+             char nextInput, int curState, int* status){
+
+    //check if it is a valid input based on the definition file
+    if (!validInput(nextInput, inputList, length)){
+        *status = RUN_INVALID_INPUT;
+        return curState;
+    }
+
     //loop through the 3 def arrays
     //when you find the index corresponding to
     //the current state and next input,
     //change the state to the value of nextState at that index
+    //epsilon transitions are only followed by the NFA engines
     for (int j = 0; j < length; j++) {
-        if (curStateList[j] == curState && inputList[j] == nextInput) {
-            int nextState = nextStateList[j];
-            if (!test) //don't print for tests
-            {printf("at step %d, "
-                    "input %c transitions FSM from state %d to state %d\n",
-                    step, nextInput, curState, nextState);}
-            curState = nextState;   //the next state becomes the new state to work with
-            break; //once you found a match, stop looping and read the next input
-        }
-        //if you got to the end of the loop and haven't found a match,
-        //you've reached a dead end
-        if (j == length - 1) {
-            printf("Error detecting state-input match for state:%d input:%c\n",
-                   curState, nextInput);
-            exit(0);
+        if (curStateList[j] == curState && inputList[j] == nextInput
+            && inputList[j] != EPSILON) {
+            *status = RUN_OK;
+            return nextStateList[j]; //once you found a match, stop looping
         }
-
     }
+    //if you got to the end of the loop and haven't found a match,
+    //you've reached a dead end
+    *status = RUN_DEAD_END;
     return curState;
 
 }
 
+//makes an empty file in memory, so tests don't depend on a writable /tmp,
+//and puts a path that opens it in path. returns its fd, or -1 if there is
+//no memfd or /proc, in which case tests that need a file are skipped
+int memoryFile(char* path, size_t size){
+    int fd = memfd_create("fsmtest", 0);
+    if (fd < 0){
+        return -1;
+    }
+    snprintf(path, size, "/proc/self/fd/%d", fd);
+    if (access(path, R_OK | W_OK) != 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 //tests functions
 //tests for both upper and lowercase letters, ints of varying lengths
 int test(){
@@ -325,7 +1553,5000 @@ int test(){
     //test function to check for valid input
     int test3 = validInput('z',testInputList,4);
 
-    //if all functions produced expected results, return 1
-    return (test1 == 8000 && test2 == 6 && test3 == 0);
+    //test the compiled table: same final state, and errors are reported
+    FSMTable* table = compileFSM(4, testCurStateList, testInputList,
+                                 testNextStateList);
+    long long steps;
+    int status;
+    int test4 = table->stateIds[runTable(table, testInputOrder, 3, table->start,
+                                         &steps, &status)];
+    int test5 = (status == RUN_OK && steps == 3);
+    runTable(table, "tz", 2, table->start, &steps, &status);
+    int test6 = (status == RUN_INVALID_INPUT && steps == 1);
+    runTable(table, "te", 2, table->start, &steps, &status);
+    int test7 = (status == RUN_DEAD_END && steps == 1);
+
+    //test sessions: 3 interleaved sessions on 2 workers
+    //session 0 gets t,t,S (ends at 6), session 1 gets t (ends at 8000)
+    //and session 2 gets t,e (dead end)
+    SessionEngine* engine = sessionEngineCreate(table, 3, 2);
+    sessionEngineStart(engine);
+    const char* events = "tttteS";
+    const int sessions[] = {0, 1, 2, 0, 2, 0};
+    for (int i = 0; i < 6; i++){
+        sessionEnginePost(engine, sessions[i], events[i]);
+    }
+    sessionEngineFinish(engine);
+    int test8 = (table->stateIds[sessionEngineSlot(engine, 0)->state] == 6
+                 && sessionEngineSlot(engine, 0)->steps == 3
+                 && table->stateIds[sessionEngineSlot(engine, 1)->state] == 8000
+                 && sessionEngineSlot(engine, 2)->status == RUN_DEAD_END);
+    sessionEngineFree(engine);
+
+    //test reloading: sessions 0 and 1 are at 8000 and 4 when the
+    //definition changes to one without state 4, where t goes 8000->20
+    int reloadCurStateList[] = {0, 8000};
+    char* reloadInputList = "tt";
+    int reloadNextStateList[] = {8000, 20};
+    int test9 = 1;
+    for (int policy = RELOAD_RESTART; policy <= RELOAD_STOP; policy++){
+        engine = sessionEngineCreate(table, 2, 2);
+        sessionEngineStart(engine);
+        sessionEnginePost(engine, 0, 't');
+        sessionEnginePost(engine, 1, 't');
+        sessionEnginePost(engine, 1, 't');
+        sessionEngineDrain(engine);
+        FSMTable* newTable = compileFSM(2, reloadCurStateList, reloadInputList,
+                                        reloadNextStateList);
+        FSMTable* old = sessionEngineReload(engine, newTable, policy);
+        sessionEnginePost(engine, 0, 't');
+        sessionEnginePost(engine, 1, 't');
+        sessionEngineFinish(engine);
+        const SessionSlot* slot0 = sessionEngineSlot(engine, 0);
+        const SessionSlot* slot1 = sessionEngineSlot(engine, 1);
+        test9 = test9 && old == table
+                && newTable->stateIds[slot0->state] == 20
+                && (policy == RELOAD_RESTART
+                    ? newTable->stateIds[slot1->state] == 8000
+                    : slot1->status == RUN_STATE_REMOVED && slot1->stateId == 4);
+        sessionEngineFree(engine);
+        freeFSMTable(newTable);
+    }
+    //test breakpoints: "ttS" enters 8000, then 4, then 6.
+    //it should stop entering 8000, then before S, then at the end
+    char stateBreak[5] = {0, 0, 0, 0, 0};
+    char inputBreak[256] = {0};
+    int state = table->start;
+    int step = 0;
+    for (int i = 0; i < table->numStates; i++){
+        stateBreak[i] = (table->stateIds[i] == 8000);
+    }
+    inputBreak['S'] = 1;
+    int reason1 = runToBreak(table, testInputOrder, 3, &state, &step, 3,
+                             stateBreak, inputBreak, &status);
+    int reason2 = runToBreak(table, testInputOrder, 3, &state, &step, 3,
+                             stateBreak, inputBreak, &status);
+    int reason3 = runToBreak(table, testInputOrder, 3, &state, &step, 3,
+                             stateBreak, inputBreak, &status);
+    int test11 = (reason1 == 1 && reason2 == 2 && reason3 == 0 && step == 3
+                  && table->stateIds[state] == 6 && status == RUN_OK);
+    freeFSMTable(table);
+
+    //test tracing: record 3000 random steps, then check that seeking
+    //forward and backward gives the same states as the run
+    int genCurStateList[64 * 4];
+    char genInputList[64 * 4];
+    int genNextStateList[64 * 4];
+    generateFSM(64, 4, 7, genCurStateList, genInputList, genNextStateList);
+    table = compileFSM(64 * 4, genCurStateList, genInputList, genNextStateList);
+    char genInputOrder[3000];
+    int genStates[3001];
+    unsigned long long seed = 99;
+    int genState = table->start;
+    genStates[0] = 0;
+    for (int i = 0; i < 3000; i++){
+        genInputOrder[i] = (char)('a' + rngNext(&seed) % 4);
+        genState = runTable(table, genInputOrder + i, 1, genState, &steps, &status);
+        genStates[i + 1] = table->stateIds[genState];
+    }
+    char traceFile[64];
+    int fd = memoryFile(traceFile, sizeof(traceFile));
+    int test10 = (fd < 0);
+    if (fd >= 0){
+        TraceWriter* writer = traceCreate(traceFile, 0);
+        runTraced(table, genInputOrder, 3000, writer, &steps, &status);
+        int written = traceClose(writer, status, 0) == 0;
+        TraceReader reader;
+        if (traceOpen(&reader, traceFile)){
+            TraceCursor cursor;
+            const int seeks[] = {0, 2999, 1024, 1023, 3000, 5, 2048};
+            test10 = written && reader.footer->steps == 3000;
+            for (int i = 0; i < 7; i++){
+                traceSeek(&reader, &cursor, seeks[i]);
+                test10 = test10 && cursor.state == genStates[seeks[i]];
+            }
+            traceSeek(&reader, &cursor, 1020);
+            for (int i = 1021; i <= 1030; i++){
+                test10 = test10 && traceNext(&reader, &cursor)
+                         && cursor.state == genStates[i]
+                         && cursor.input == genInputOrder[i - 1];
+            }
+            traceCloseReader(&reader);
+            //a footer that claims more steps than the records hold is
+            //rejected instead of read past
+            uint64_t badSteps = 1000000000;
+            off_t footerAt = lseek(fd, 0, SEEK_END) - sizeof(TraceFooter);
+            test10 = test10 && pwrite(fd, &badSteps, sizeof(badSteps), footerAt)
+                               == sizeof(badSteps)
+                     && !traceOpen(&reader, traceFile);
+        }
+        close(fd);
+    }
+    freeFSMTable(table);
+
+    //test the NFA: 0 on a goes to 1 and 2, 2 has an epsilon move to 3,
+    //and only 1 and 3 have b transitions
+    int nfaCurStateList[] = {0, 0, 2, 1, 3, 5};
+    char nfaInputList[] = {'a', 'a', EPSILON, 'b', 'b', 'c'};
+    int nfaNextStateList[] = {1, 2, 3, 0, 5, 0};
+    NFATable* nfa = compileNFA(6, nfaCurStateList, nfaInputList, nfaNextStateList);
+    uint64_t set[1];
+    int ids[6];
+    for (int i = 0; i < nfa->numStates; i++){
+        ids[nfa->stateIds[i]] = i;
+    }
+    memcpy(set, nfa->startSet, sizeof(set));
+    int count1 = runNFA(nfa, "a", 1, set, &steps, &status);
+    int test12 = (count1 == 3 && set[0] == ((1ULL << ids[1]) | (1ULL << ids[2])
+                                             | (1ULL << ids[3])));
+    memcpy(set, nfa->startSet, sizeof(set));
+    int count2 = runNFA(nfa, "abac", 4, set, &steps, &status);
+    test12 = test12 && count2 == 3 && status == RUN_DEAD_END && steps == 3;
+    //the deterministic scan doesn't take epsilon moves as a NUL input
+    scanStep(6, nfaCurStateList, nfaInputList, nfaNextStateList, EPSILON, 2,
+             &status);
+    test12 = test12 && status == RUN_INVALID_INPUT;
+
+    //the lazy DFA must agree, even with room for only 2 states
+    LazyDFA dfa;
+    lazyDFAInit(&dfa, nfa, 1);
+    int dfaState = runLazyDFA(&dfa, "ababab", 6, lazyDFAStart(&dfa),
+                              &steps, &status);
+    memcpy(set, nfa->startSet, sizeof(set));
+    runNFA(nfa, "ababab", 6, set, &steps, &status);
+    test12 = test12 && status == RUN_OK && dfa.flushes > 0
+             && dfa.sets[dfaState] == set[0];
+    lazyDFAFree(&dfa);
+    freeNFATable(nfa);
+
+    //test compression: the generated machine and the test machine must
+    //give the same results as the dense table on every prefix
+    int test13 = 1;
+    for (int m = 0; m < 2; m++){
+        table = m ? compileFSM(4, testCurStateList, testInputList,
+                               testNextStateList)
+                  : compileFSM(64 * 4, genCurStateList, genInputList,
+                               genNextStateList);
+        const char* inputs = m ? "ttSe" : genInputOrder;
+        int count = m ? 4 : 3000;
+        CombTable* comb = compressFSM(table);
+        int denseState = table->start, combState = comb->start;
+        int combStatus;
+        long long combSteps;
+        for (int i = 0; i < count && test13; i++){
+            denseState = runTable(table, inputs + i, 1, denseState, &steps, &status);
+            combState = runComb(comb, inputs + i, 1, combState, &combSteps,
+                                &combStatus);
+            test13 = denseState == combState && status == combStatus
+                     && steps == combSteps;
+        }
+        test13 = test13 && (m || status == RUN_OK) && (!m || status == RUN_DEAD_END);
+        freeCombTable(comb);
+        freeFSMTable(table);
+    }
+
+    //test layout: on "tt" the hot states are 0, 8000 and 4, in that order,
+    //and the renumbered table must still give the same results
+    table = compileFSM(4, testCurStateList, testInputList, testNextStateList);
+    int* order = profileLayout(table, "tt", 2);
+    FSMTable* permuted = permuteFSM(table, order);
+    int test14 = (permuted->stateIds[0] == 0 && permuted->stateIds[1] == 8000
+                  && permuted->stateIds[2] == 4 && permuted->start == 0
+                  && permuted->stateIds[runTable(permuted, testInputOrder, 3,
+                                                 permuted->start, &steps,
+                                                 &status)] == 6);
+    free(order);
+    freeFSMTable(permuted);
+    freeFSMTable(table);
+
+    //test streaming: a leading newline is an input, like fscanf's %c,
+    //and later whitespace is skipped
+    char streamFile[64];
+    fd = memoryFile(streamFile, sizeof(streamFile));
+    int test15 = (fd < 0);
+    if (fd >= 0){
+        const char* text = "t\nt\r\n\n S\n";
+        test15 = write(fd, text, strlen(text)) == (ssize_t)strlen(text);
+        table = compileFSM(4, testCurStateList, testInputList, testNextStateList);
+        InputStream* stream = streamOpen(streamFile);
+        char badInput;
+        int state = runStream(table, stream, &steps, &status, &badInput);
+        streamClose(stream);
+        test15 = test15 && status == RUN_OK && steps == 3
+                 && table->stateIds[state] == 6;
+        test15 = test15 && ftruncate(fd, 0) == 0 && pwrite(fd, "\nt", 2, 0) == 2;
+        stream = streamOpen(streamFile);
+        runStream(table, stream, &steps, &status, &badInput);
+        streamClose(stream);
+        test15 = test15 && status == RUN_INVALID_INPUT && badInput == '\n'
+                 && steps == 0;
+        freeFSMTable(table);
+        close(fd);
+    }
+    //a read error is an error, not the end of the inputs: reading a
+    //directory fails with EISDIR
+    table = compileFSM(4, testCurStateList, testInputList, testNextStateList);
+    InputStream* badStream = streamOpen("/");
+    if (badStream){
+        char badInput;
+        runStream(table, badStream, &steps, &status, &badInput);
+        streamClose(badStream);
+        test15 = test15 && status == RUN_READ_ERROR && steps == 0;
+    }
+    freeFSMTable(table);
+
+    //test parsing the way storeData does, including epsilon transitions
+    int parsedCur, parsedNext;
+    char parsedInput;
+    const char* lines[] = {"12:a>-3", "0:>>1", "0:>1", "0:a1", "x:a>1", "5:b>"};
+    int parsed[6];
+    for (int i = 0; i < 6; i++){
+        parsed[i] = parseTransition(lines[i], lines[i] + strlen(lines[i]),
+                                    &parsedCur, &parsedInput, &parsedNext);
+        if (i == 0){
+            parsed[i] = parsed[i] && parsedCur == 12 && parsedInput == 'a'
+                        && parsedNext == -3;
+        }
+        if (i == 2){
+            parsed[i] = parsed[i] && parsedInput == EPSILON && parsedNext == 1;
+        }
+    }
+    int test16 = (parsed[0] && parsed[1] && parsed[2] && !parsed[3] && !parsed[4]
+                  && !parsed[5]);
+
+    //a few random machines through every engine
+    int test17 = (fuzzEngines(20, 2024, 0) == 0);
+
+    //test a transducer: outputs on transitions, and on entering state 4
+    const char* transducerText = "0:t>8000/A\n8000:t>4\n4/<\\s>\n4:S>6/B\\n\n";
+    Transducer* transducer = parseTransducer(transducerText, strlen(transducerText));
+    int pipeFds[2];
+    int test18 = 0;
+    if (transducer && pipe(pipeFds) == 0){
+        OutputBuffer out;
+        outputInit(&out, pipeFds[1]);
+        runTransducer(transducer, "ttS", 3, &out, &steps, &status);
+        outputFlush(&out);
+        close(pipeFds[1]);
+        char got[32] = {0};
+        ssize_t size = read(pipeFds[0], got, sizeof(got) - 1);
+        close(pipeFds[0]);
+        test18 = size == 6 && !strcmp(got, "A< >B\n") && status == RUN_OK;
+        free(out.staging);
+    }
+    if (transducer){
+        freeTransducer(transducer);
+    }
+
+    //long outputs, which get their own iovecs, between short ones, which
+    //are copied, for well over OUTPUT_IOVECS iovecs. then a failed write
+    const char* mixedText = "0:a>0/0123456789012345678901234567890123456789"
+                            "012345678901234567890123456789\n0:b>0/x\n";
+    transducer = parseTransducer(mixedText, strlen(mixedText));
+    char mixedInputs[6000];
+    for (int i = 0; i < 6000; i++){
+        mixedInputs[i] = i % 2 ? 'b' : 'a';
+    }
+    char mixedFile[64];
+    int mixedFd = memoryFile(mixedFile, sizeof(mixedFile));
+    int mixedInMemory = mixedFd >= 0;
+    mixedFd = mixedInMemory ? mixedFd : open("/dev/null", O_WRONLY);
+    test18 = test18 && transducer && mixedFd >= 0;
+    if (test18){
+        OutputBuffer out;
+        outputInit(&out, mixedFd);
+        runTransducer(transducer, mixedInputs, 6000, &out, &steps, &status);
+        outputFlush(&out);
+        //each a writes 70 digits, each b writes x
+        test18 = out.bytes == 3000 * 71 && !out.error && status == RUN_OK;
+        if (mixedInMemory){
+            char got[71];
+            test18 = test18 && lseek(mixedFd, 0, SEEK_END) == 3000 * 71
+                     && pread(mixedFd, got, 71, 2999 * 71) == 71
+                     && got[0] == '0' && got[69] == '9' && got[70] == 'x';
+        }
+        free(out.staging);
+
+        int readOnly = open("/dev/null", O_RDONLY);
+        outputInit(&out, readOnly);
+        runTransducer(transducer, mixedInputs, 6000, &out, &steps, &status);
+        outputFlush(&out);
+        test18 = test18 && out.error == EBADF && out.bytes == 0;
+        free(out.staging);
+        close(readOnly);
+    }
+    if (mixedFd >= 0){
+        close(mixedFd);
+    }
+    if (transducer){
+        freeTransducer(transducer);
+    }
+
+    //test summaries: from 0, "tt" ends at 4; from 8000 it reaches 4 and
+    //then has no transition for t; with "tz" every run that is still going
+    //stops at the z
+    table = compileFSM(4, testCurStateList, testInputList, testNextStateList);
+    InputSummary* summary = summarizeInputs(table, "tt", 2);
+    int from0 = summaryLookup(summary, table->start, &steps, &status);
+    int test19 = (table->stateIds[from0] == 4 && steps == 2 && status == RUN_OK);
+    for (int s = 0; s < table->numStates; s++){
+        int end = summaryLookup(summary, s, &steps, &status);
+        if (table->stateIds[s] == 8000){
+            test19 = test19 && table->stateIds[end] == 4 && steps == 1
+                     && status == RUN_DEAD_END;
+        }
+        else if (table->stateIds[s] != 0){
+            test19 = test19 && end == s && steps == 0 && status == RUN_DEAD_END;
+        }
+    }
+    freeSummary(summary);
+    summary = summarizeInputs(table, "tz", 2);
+    for (int s = 0; s < table->numStates; s++){
+        int end = summaryLookup(summary, s, &steps, &status);
+        int id = table->stateIds[s];
+        if (id == 0 || id == 8000){
+            test19 = test19 && table->stateIds[end] == (id ? 4 : 8000)
+                     && steps == 1 && status == RUN_INVALID_INPUT;
+        }
+    }
+    freeSummary(summary);
+    freeFSMTable(table);
 
+    //test narrow tables: the test machine fits in 1 byte entries, and
+    //wider entries give the same results
+    table = compileFSM(4, testCurStateList, testInputList, testNextStateList);
+    int test20 = 1;
+    for (int width = 0; width <= 4; width = width ? width * 2 : 1){
+        NarrowTable* narrow = narrowFSM(table, width);
+        int end = runNarrow(narrow, testInputOrder, 3, narrow->start, &steps,
+                            &status);
+        test20 = test20 && narrow->width == (width ? width : 1)
+                 && narrow->stateIds[end] == 6 && steps == 3 && status == RUN_OK;
+        runNarrow(narrow, "te", 2, narrow->start, &steps, &status);
+        test20 = test20 && status == RUN_DEAD_END && steps == 1;
+        freeNarrowTable(narrow);
+    }
+    freeFSMTable(table);
+
+    //test regexes: (a|b)*abb needs 4 states once minimized, and with two
+    //patterns the first one given wins
+    const char* patterns[] = {"(a|b)*abb", "if", "[a-z]\\w*", "a(b"};
+    const char* regexError;
+    RegexDFA* regex = compileRegexes(1, patterns, &regexError);
+    int test21 = regex && regex->numStates == 4;
+    int regexLength;
+    int *regexCurStates, *regexNextStates;
+    char* regexInputs;
+    if (regex){
+        regexLength = regexTransitions(regex, &regexCurStates, &regexInputs,
+                                       &regexNextStates);
+        table = compileFSM(regexLength, regexCurStates, regexInputs, regexNextStates);
+        int end = runTable(table, "babb", 4, table->start, &steps, &status);
+        test21 = test21 && regex->tag[table->stateIds[end]] == 0;
+        end = runTable(table, "abba", 4, table->start, &steps, &status);
+        test21 = test21 && regex->tag[table->stateIds[end]] < 0;
+        freeFSMTable(table);
+        free(regexCurStates);
+        free(regexInputs);
+        free(regexNextStates);
+        freeRegexDFA(regex);
+    }
+    regex = compileRegexes(2, patterns + 1, &regexError);
+    test21 = test21 && regex;
+    if (regex){
+        regexLength = regexTransitions(regex, &regexCurStates, &regexInputs,
+                                       &regexNextStates);
+        table = compileFSM(regexLength, regexCurStates, regexInputs, regexNextStates);
+        int end = runTable(table, "if", 2, table->start, &steps, &status);
+        test21 = test21 && regex->tag[table->stateIds[end]] == 0;
+        end = runTable(table, "if_1", 4, table->start, &steps, &status);
+        test21 = test21 && regex->tag[table->stateIds[end]] == 1;
+        freeFSMTable(table);
+        free(regexCurStates);
+        free(regexInputs);
+        free(regexNextStates);
+        freeRegexDFA(regex);
+    }
+    test21 = test21 && !compileRegexes(1, patterns + 3, &regexError);
+
+    //test real-time steps: the same results as runTable, and a run that
+    //has stopped ignores later events
+    table = compileFSM(4, testCurStateList, testInputList, testNextStateList);
+    RealtimeRun run;
+    realtimeInit(&run, table, 0);
+    for (int i = 0; i < 3; i++){
+        realtimeStep(&run, testInputOrder[i]);
+    }
+    int test22 = (table->stateIds[run.state] == 6 && run.steps == 3
+                  && run.status == RUN_OK);
+    test22 = test22 && realtimeStep(&run, 'e') == RUN_DEAD_END
+             && realtimeStep(&run, 't') == RUN_DEAD_END
+             && table->stateIds[run.state] == 6 && run.steps == 3
+             && run.badInput == 'e';
+    realtimeInit(&run, table, 0);
+    test22 = test22 && realtimeStep(&run, 'z') == RUN_INVALID_INPUT
+             && run.steps == 0;
+    realtimeFree(&run);
+    freeFSMTable(table);
+
+    //test that reloading a missing or broken definition fails instead of
+    //exiting, and that a good one still loads
+    Options noOptions = {0};
+    fflush(stdout);
+    int savedStdout = dup(1);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 1);
+    int test23 = (loadFSM(&noOptions, "/nonexistent/definition.fsm", 0, NULL)
+                  == NULL);
+    int definitionFd = memfd_create("fsmtest", 0);
+    if (definitionFd >= 0){
+        char definitionPath[64];
+        snprintf(definitionPath, sizeof(definitionPath), "/proc/self/fd/%d",
+                 definitionFd);
+        test23 = test23 && write(definitionFd, "0:a>1\n1:a>0\n", 12) == 12;
+        table = loadFSM(&noOptions, definitionPath, 0, NULL);
+        test23 = test23 && table && table->numStates == 2;
+        freeFSMTable(table);
+        test23 = test23 && write(definitionFd, "1:b\n", 4) == 4
+                 && loadFSM(&noOptions, definitionPath, 0, NULL) == NULL;
+        close(definitionFd);
+    }
+    fflush(stdout);
+    dup2(savedStdout, 1);
+    close(savedStdout);
+    close(devNull);
+
+    //if all functions produced expected results, return 1
+    return (test1 == 8000 && test2 == 6 && test3 == 0 && test4 == 6 && test5
+            && test6 && test7 && test8 && test9
+            && test10 && test11 && test12 && test13 && test14 && test15
+            && test16 && test17 && test18 && test19 && test20 && test21
+            && test22 && test23);
+
+}
+
+//initializes a hash map with room for the expected number of keys
+void intMapInit(IntMap* map, int expected){
+    map->capacity = 16;
+    while (map->capacity < expected * 2){
+        map->capacity *= 2;
+    }
+    map->count = 0;
+    map->keys = malloc(sizeof(int) * map->capacity);
+    map->values = malloc(sizeof(int) * map->capacity);
+    map->used = calloc(map->capacity, 1);
+}
+
+//finds the slot for a key: either the slot holding it or an empty one
+static int intMapSlot(const IntMap* map, int key){
+    unsigned int h = (unsigned int)key * 2654435761u;
+    int slot = h & (map->capacity - 1);
+    while (map->used[slot] && map->keys[slot] != key){
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return slot;
+}
+
+//returns the value stored for key, or -1 if there is none
+int intMapGet(const IntMap* map, int key){
+    int slot = intMapSlot(map, key);
+    return map->used[slot] ? map->values[slot] : -1;
+}
+
+//stores a value for key, growing the map when it gets half full
+void intMapPut(IntMap* map, int key, int value){
+    if ((map->count + 1) * 2 > map->capacity){
+        IntMap bigger;
+        intMapInit(&bigger, map->capacity);
+        for (int i = 0; i < map->capacity; i++){
+            if (map->used[i]){
+                intMapPut(&bigger, map->keys[i], map->values[i]);
+            }
+        }
+        intMapFree(map);
+        *map = bigger;
+    }
+    int slot = intMapSlot(map, key);
+    if (!map->used[slot]){
+        map->used[slot] = 1;
+        map->keys[slot] = key;
+        map->count++;
+    }
+    map->values[slot] = value;
+}
+
+void intMapFree(IntMap* map){
+    free(map->keys);
+    free(map->values);
+    free(map->used);
+}
+
+//gives a state id a dense index if it doesn't have one yet
+static int addState(FSMTable* table, IntMap* ids, int id){
+    int index = intMapGet(ids, id);
+    if (index < 0){
+        index = table->numStates++;
+        table->stateIds[index] = id;
+        intMapPut(ids, id, index);
+    }
+    return index;
+}
+
+//compiles the 3 parallel definition arrays into a dense transition table.
+//like moveOne, the first transition listed for a state and input wins
+FSMTable* compileFSM(int length, int* curStateList, char* inputList,
+                     int* nextStateList){
+    FSMTable* table = calloc(1, sizeof(FSMTable));
+    table->stateIds = malloc(sizeof(int) * (2 * length + 1));
+
+    //number the states in order of appearance.
+    //state 0 is always the start state, so it gets index 0
+    IntMap ids;
+    intMapInit(&ids, 2 * length + 1);
+    table->start = addState(table, &ids, 0);
+    for (int i = 0; i < length; i++){
+        addState(table, &ids, curStateList[i]);
+        addState(table, &ids, nextStateList[i]);
+    }
+
+    //every char that appears in the definition is a valid input
+    for (int c = 0; c < 256; c++){
+        table->classOf[c] = -1;
+    }
+    for (int i = 0; i < length; i++){
+        unsigned char c = inputList[i];
+        if (c != EPSILON && table->classOf[c] < 0){
+            table->classChar[table->numClasses] = c;
+            table->classOf[c] = table->numClasses++;
+        }
+    }
+
+    //start with every transition going to the dead state,
+    //then fill in the ones from the definition
+    table->dead = table->numStates;
+    size_t cells = (size_t)(table->numStates + 1) * table->numClasses;
+    table->next = malloc(sizeof(int) * (cells ? cells : 1));
+    for (size_t i = 0; i < cells; i++){
+        table->next[i] = table->dead;
+    }
+    for (int i = 0; i < length; i++){
+        if (inputList[i] == EPSILON){
+            continue; //only NFA mode follows epsilon transitions
+        }
+        size_t cell = (size_t)intMapGet(&ids, curStateList[i]) * table->numClasses
+                      + table->classOf[(unsigned char)inputList[i]];
+        if (table->next[cell] == table->dead){
+            table->next[cell] = intMapGet(&ids, nextStateList[i]);
+        }
+    }
+    intMapFree(&ids);
+    return table;
+}
+
+void freeFSMTable(FSMTable* table){
+    if (!table){
+        return;
+    }
+    free(table->stateIds);
+    free(table->next);
+    free(table->remap);
+    free(table);
+}
+
+//runs the inputs through a compiled table without printing anything.
+//returns the final dense state, and reports the number of steps taken
+//and whether the run stopped on an invalid input or a dead end
+int runTable(const FSMTable* table, const char* inputOrder, long long length2,
+             int startState, long long* step, int* status){
+    int curState = startState;
+    long long i;
+    *status = RUN_OK;
+    for (i = 0; i < length2; i++){
+        int cls = table->classOf[(unsigned char)inputOrder[i]];
+        if (cls < 0){
+            *status = RUN_INVALID_INPUT;
+            break;
+        }
+        int nextState = table->next[(size_t)curState * table->numClasses + cls];
+        if (nextState == table->dead){
+            *status = RUN_DEAD_END;
+            break;
+        }
+        curState = nextState;
+    }
+    *step = i;
+    return curState;
+}
+
+//xorshift random numbers, so generated machines are reproducible
+unsigned long long rngNext(unsigned long long* seed){
+    unsigned long long x = *seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *seed = x;
+    return x;
+}
+
+//generates a complete random FSM with states 0..numStates-1 and inputs
+//starting at 'a'. the arrays must hold numStates*numInputs transitions
+void generateFSM(int numStates, int numInputs, unsigned long long seed,
+                 int* curStateList, char* inputList, int* nextStateList){
+    int i = 0;
+    for (int state = 0; state < numStates; state++){
+        for (int input = 0; input < numInputs; input++){
+            curStateList[i] = state;
+            inputList[i] = (char)('a' + input);
+            nextStateList[i] = (int)(rngNext(&seed) % numStates);
+            i++;
+        }
+    }
+}
+
+//returns the current time in seconds, for measuring throughput
+double seconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+//thread counts for benchmarks: doubles each time, but always finishes
+//with one thread per core. returns more than cores when done
+int nextThreadCount(int threads, int cores){
+    return threads < cores && threads * 2 > cores ? cores : threads * 2;
+}
+
+//sets up an empty queue. size must be a power of 2
+void queueInit(EventQueue* queue, size_t size){
+    queue->cells = malloc(sizeof(QueueCell) * size);
+    for (size_t i = 0; i < size; i++){
+        atomic_init(&queue->cells[i].seq, i);
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->tail, 0);
+    queue->head = 0;
+}
+
+//adds a value to the queue. any thread may push.
+//each cell's sequence number says whose turn it is: a producer may fill
+//cell pos when seq == pos, and the consumer may read it when seq == pos+1.
+//returns 0 if the queue is full
+int queuePush(EventQueue* queue, uint64_t value){
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    for (;;){
+        QueueCell* cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0){
+            //claim the cell; on failure pos is reloaded with the new tail
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)){
+                cell->value = value;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        }
+        else if (diff < 0){
+            return 0; //full: the consumer hasn't freed this cell yet
+        }
+        else{
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+}
+
+//takes the next value off the queue. only the owning worker may pop.
+//returns 0 if the queue is empty
+int queuePop(EventQueue* queue, uint64_t* value){
+    QueueCell* cell = &queue->cells[queue->head & queue->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if (seq != queue->head + 1){
+        return 0;
+    }
+    *value = cell->value;
+    //hand the cell back to producers for the next lap around the ring
+    atomic_store_explicit(&cell->seq, queue->head + queue->mask + 1,
+                          memory_order_release);
+    queue->head++;
+    return 1;
+}
+
+void queueFree(EventQueue* queue){
+    free(queue->cells);
+}
+
+//pins each session to a worker by hash and gives it a slot in that worker
+SessionEngine* sessionEngineCreate(const FSMTable* table, int numSessions,
+                                   int numWorkers){
+    SessionEngine* engine = calloc(1, sizeof(SessionEngine));
+    atomic_init(&engine->table, table);
+    engine->numSessions = numSessions;
+    engine->numWorkers = numWorkers;
+    engine->sessionWorker = malloc(sizeof(int) * numSessions);
+    engine->sessionSlot = malloc(sizeof(int) * numSessions);
+    engine->workers = calloc(numWorkers, sizeof(Worker));
+
+    for (int i = 0; i < numSessions; i++){
+        unsigned int h = (unsigned int)i * 2654435761u;
+        int w = (int)(((unsigned long long)h * numWorkers) >> 32);
+        engine->sessionWorker[i] = w;
+        engine->sessionSlot[i] = engine->workers[w].numSlots++;
+    }
+
+    //each worker's slots are allocated separately,
+    //so workers never write to the same cache lines
+    for (int w = 0; w < numWorkers; w++){
+        Worker* worker = &engine->workers[w];
+        worker->engine = engine;
+        worker->table = table;
+        atomic_init(&worker->inUse, table);
+        worker->slots = calloc(worker->numSlots ? worker->numSlots : 1,
+                               sizeof(SessionSlot));
+        for (int i = 0; i < worker->numSlots; i++){
+            worker->slots[i].state = table->start;
+        }
+        queueInit(&worker->queue, QUEUE_SIZE);
+    }
+    return engine;
+}
+
+//moves one session forward one state
+static void sessionStep(const FSMTable* table, SessionSlot* slot, char input){
+    if (slot->status != RUN_OK){
+        return; //this session already stopped on an error
+    }
+    int cls = table->classOf[(unsigned char)input];
+    if (cls < 0){
+        slot->status = RUN_INVALID_INPUT;
+        slot->badInput = input;
+        slot->stateId = table->stateIds[slot->state];
+        return;
+    }
+    int nextState = table->next[(size_t)slot->state * table->numClasses + cls];
+    if (nextState == table->dead){
+        slot->status = RUN_DEAD_END;
+        slot->badInput = input;
+        slot->stateId = table->stateIds[slot->state];
+        return;
+    }
+    slot->state = nextState;
+    slot->steps++;
+}
+
+//moves this worker's sessions onto a table installed by a reload
+static void remapSessions(Worker* worker, const FSMTable* table){
+    for (int i = 0; i < worker->numSlots; i++){
+        SessionSlot* slot = &worker->slots[i];
+        int state = table->remap[slot->state];
+        if (state < 0){
+            //the state is gone and the reload policy is to stop
+            if (slot->status == RUN_OK){
+                slot->status = RUN_STATE_REMOVED;
+                slot->stateId = worker->table->stateIds[slot->state];
+            }
+            state = table->dead;
+        }
+        slot->state = state;
+    }
+}
+
+//worker thread: drains its queue in batches until it sees EVENT_STOP.
+//the table is only picked up between batches, so a batch always runs
+//on one version of the definition
+static void* workerMain(void* arg){
+    Worker* worker = arg;
+    SessionEngine* engine = worker->engine;
+    int idle = 0;
+    for (;;){
+        const FSMTable* table = atomic_load(&engine->table);
+        if (table != worker->table){
+            remapSessions(worker, table);
+            worker->table = table;
+            //tells the reloader this worker is done with the old table
+            atomic_store(&worker->inUse, table);
+        }
+
+        int n;
+        uint64_t event;
+        for (n = 0; n < WORKER_BATCH && queuePop(&worker->queue, &event); n++){
+            if (event == EVENT_STOP){
+                atomic_fetch_add_explicit(&worker->processed, n,
+                                          memory_order_release);
+                return NULL;
+            }
+            int session = (int)(event >> 8);
+            sessionStep(table, &worker->slots[engine->sessionSlot[session]],
+                        (char)(event & 0xff));
+        }
+        atomic_fetch_add_explicit(&worker->processed, n, memory_order_release);
+
+        //back off when the queue is empty
+        if (n == 0 && ++idle > 64){
+            sched_yield();
+        }
+        else if (n){
+            idle = 0;
+        }
+    }
+}
+
+void sessionEngineStart(SessionEngine* engine){
+    for (int w = 0; w < engine->numWorkers; w++){
+        pthread_create(&engine->workers[w].thread, NULL, workerMain,
+                       &engine->workers[w]);
+    }
+}
+
+//sends one input to a session. safe to call from several threads
+void sessionEnginePost(SessionEngine* engine, int session, char input){
+    Worker* worker = &engine->workers[engine->sessionWorker[session]];
+    uint64_t event = ((uint64_t)session << 8) | (unsigned char)input;
+    atomic_fetch_add_explicit(&worker->posted, 1, memory_order_relaxed);
+    while (!queuePush(&worker->queue, event)){
+        sched_yield(); //queue full, let the worker catch up
+    }
+}
+
+//waits until every event posted so far has been processed
+void sessionEngineDrain(SessionEngine* engine){
+    for (int w = 0; w < engine->numWorkers; w++){
+        Worker* worker = &engine->workers[w];
+        while (atomic_load_explicit(&worker->processed, memory_order_acquire)
+               < atomic_load_explicit(&worker->posted, memory_order_relaxed)){
+            sched_yield();
+        }
+    }
+}
+
+//swaps in a new compiled table while the workers keep running.
+//batches already running finish on the old table; each worker moves its
+//sessions to the new table before its next batch, mapping states by id.
+//events still queued are applied to the new table, so callers that need
+//an exact boundary call sessionEngineDrain first.
+//returns the old table once no worker uses it, so the caller can free it.
+//must be called after sessionEngineStart and before sessionEngineFinish,
+//and only from one thread at a time
+FSMTable* sessionEngineReload(SessionEngine* engine, FSMTable* table, int policy){
+    const FSMTable* old = atomic_load(&engine->table);
+
+    //work out where each old state goes before anyone can see the table
+    IntMap ids;
+    intMapInit(&ids, table->numStates);
+    for (int i = 0; i < table->numStates; i++){
+        intMapPut(&ids, table->stateIds[i], i);
+    }
+    free(table->remap);
+    table->remap = malloc(sizeof(int) * (old->numStates + 1));
+    for (int i = 0; i < old->numStates; i++){
+        int state = intMapGet(&ids, old->stateIds[i]);
+        if (state < 0){
+            state = policy == RELOAD_RESTART ? table->start : -1;
+        }
+        table->remap[i] = state;
+    }
+    table->remap[old->dead] = table->dead;
+    table->remapFrom = old;
+    intMapFree(&ids);
+
+    atomic_store(&engine->table, table);
+
+    //grace period: wait for every worker to move off the old table
+    for (int w = 0; w < engine->numWorkers; w++){
+        while (atomic_load(&engine->workers[w].inUse) == old){
+            sched_yield();
+        }
+    }
+    return (FSMTable*)old;
+}
+
+//waits for the workers to process every posted event, then stops them
+void sessionEngineFinish(SessionEngine* engine){
+    for (int w = 0; w < engine->numWorkers; w++){
+        while (!queuePush(&engine->workers[w].queue, EVENT_STOP)){
+            sched_yield();
+        }
+    }
+    for (int w = 0; w < engine->numWorkers; w++){
+        pthread_join(engine->workers[w].thread, NULL);
+    }
+    //catch up on a reload the workers stopped before seeing
+    const FSMTable* table = atomic_load(&engine->table);
+    for (int w = 0; w < engine->numWorkers; w++){
+        Worker* worker = &engine->workers[w];
+        if (worker->table != table){
+            remapSessions(worker, table);
+            worker->table = table;
+        }
+    }
+}
+
+//returns the state of a session. only valid after sessionEngineFinish
+const SessionSlot* sessionEngineSlot(const SessionEngine* engine, int session){
+    return &engine->workers[engine->sessionWorker[session]]
+            .slots[engine->sessionSlot[session]];
+}
+
+void sessionEngineFree(SessionEngine* engine){
+    for (int w = 0; w < engine->numWorkers; w++){
+        queueFree(&engine->workers[w].queue);
+        free(engine->workers[w].slots);
+    }
+    free(engine->workers);
+    free(engine->sessionWorker);
+    free(engine->sessionSlot);
+    free(engine);
+}
+
+//set by SIGHUP to ask runSessions to reload the definition file
+static volatile sig_atomic_t reloadRequested = 0;
+
+static void requestReload(int signal){
+    (void)signal;
+    reloadRequested = 1;
+}
+
+//reads and compiles a definition file for reloading while running, with
+//the same --profile and --layout renumbering as at startup. unlike
+//getLength and storeData it never exits: it prints a warning and returns
+//NULL if the file can't be read or has a syntax error, so the caller can
+//keep running on the table it has. the file is read on one thread even
+//with --jobs, which only changes how fast the startup load is
+FSMTable* loadFSM(const Options* options, char* file, int length2,
+                  char* inputOrder){
+    FILE* def = fopen(file, "r");
+    if (!def){
+        printf("Warning: can't read definition file %s, keeping the current "
+               "definition\n", file);
+        return NULL;
+    }
+    int capacity = 1024, length = 0;
+    int* curStateList = malloc(sizeof(int) * capacity);
+    char* inputList = malloc(capacity);
+    int* nextStateList = malloc(sizeof(int) * capacity);
+    char line[64];
+    int ok = 1;
+    while (ok && fscanf(def, "%63s", line) == 1){
+        if (length == capacity){
+            capacity *= 2;
+            curStateList = realloc(curStateList, sizeof(int) * capacity);
+            inputList = realloc(inputList, capacity);
+            nextStateList = realloc(nextStateList, sizeof(int) * capacity);
+        }
+        ok = parseTransition(line, line + strlen(line), &curStateList[length],
+                             &inputList[length], &nextStateList[length]);
+        length++;
+    }
+    fclose(def);
+
+    FSMTable* table = NULL;
+    if (!ok){
+        printf("Warning: syntax error in definition file %s, keeping the "
+               "current definition\n", file);
+    }
+    //a layout file that has gone away means the plain layout, not an exit
+    else if (options->layout && options->profile <= 0
+             && access(options->layout, R_OK) != 0){
+        printf("Warning: can't read layout file %s, using the plain layout\n",
+               options->layout);
+        table = compileFSM(length, curStateList, inputList, nextStateList);
+    }
+    else{
+        table = buildTable(options, length, curStateList, inputList, nextStateList,
+                           length2, inputOrder);
+    }
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+    return table;
+}
+
+//deals the inputs out to the sessions in turn (input i goes to session
+//i % sessions), runs them on the worker threads and prints every session.
+//on SIGHUP the definition file is read again and swapped in
+void runSessions(const Options* options, char* file1, int length,
+                 int* curStateList, char* inputList, int* nextStateList,
+                 int length2, char* inputOrder){
+    int workers = options->workers > 0 ? options->workers
+                                       : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    FSMTable* table = buildTable(options, length, curStateList, inputList,
+                                 nextStateList, length2, inputOrder);
+    if (options->stats){
+        printStats(length, length2, table, NULL);
+    }
+    SessionEngine* engine = sessionEngineCreate(table, options->sessions, workers);
+    signal(SIGHUP, requestReload);
+
+    double begin = seconds();
+    sessionEngineStart(engine);
+    for (int i = 0; i < length2; i++){
+        if (reloadRequested){
+            reloadRequested = 0;
+            FSMTable* newTable = loadFSM(options, file1, length2, inputOrder);
+            if (newTable){
+                //events before i finish on the old table, so the reload
+                //happens exactly at event i. reloads are rare, so the
+                //workers can afford to go idle
+                sessionEngineDrain(engine);
+                freeFSMTable(sessionEngineReload(engine, newTable,
+                                                 options->reloadPolicy));
+                table = newTable;
+                printf("reloaded FSM definition file %s at event %d\n", file1, i);
+            }
+        }
+        sessionEnginePost(engine, i % options->sessions, inputOrder[i]);
+    }
+    sessionEngineFinish(engine);
+    double elapsed = seconds() - begin;
+    signal(SIGHUP, SIG_DFL);
+
+    for (int i = 0; i < options->sessions; i++){
+        const SessionSlot* slot = sessionEngineSlot(engine, i);
+        int state = table->stateIds[slot->state];
+        if (slot->status == RUN_INVALID_INPUT){
+            printf("session %d: Error: %c is invalid input\n", i, slot->badInput);
+        }
+        else if (slot->status == RUN_DEAD_END){
+            printf("session %d: Error detecting state-input match for "
+                   "state:%d input:%c\n", i, slot->stateId, slot->badInput);
+        }
+        else if (slot->status == RUN_STATE_REMOVED){
+            printf("session %d: Error: state %d was removed by a reload\n",
+                   i, slot->stateId);
+        }
+        else{
+            printf("session %d: after %lld steps, state machine finished "
+                   "successfully at state %d\n", i, slot->steps, state);
+        }
+    }
+    printf("%d events on %d workers in %.3f s (%.0f events/s)\n",
+           length2, workers, elapsed, elapsed > 0 ? length2 / elapsed : 0);
+
+    sessionEngineFree(engine);
+    freeFSMTable(table);
+}
+
+//arguments for a benchmark producer thread
+typedef struct {
+    SessionEngine* engine;
+    int numSessions;
+    int numInputs;
+    long long events;
+    unsigned long long seed;
+} Producer;
+
+//posts random inputs to random sessions
+static void* producerMain(void* arg){
+    Producer* producer = arg;
+    for (long long i = 0; i < producer->events; i++){
+        unsigned long long r = rngNext(&producer->seed);
+        sessionEnginePost(producer->engine, (int)((r >> 8) % producer->numSessions),
+                          (char)('a' + (r & 0xff) % producer->numInputs));
+    }
+    return NULL;
+}
+
+//measures events per second for a shared 1024-state machine driven by
+//100000 sessions, with as many producers as workers, for 1 worker up to
+//one per core
+void benchSessions(){
+    int numStates = 1024, numInputs = 16, numSessions = 100000;
+    long long events = 8000000;
+    int length = numStates * numInputs;
+    int* curStateList = malloc(sizeof(int) * length);
+    char* inputList = malloc(length);
+    int* nextStateList = malloc(sizeof(int) * length);
+    generateFSM(numStates, numInputs, 42, curStateList, inputList, nextStateList);
+    FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    printf("sessions benchmark: %d states, %d sessions, %lld events, %d cores\n",
+           numStates, numSessions, events, cores);
+    for (int workers = 1; workers <= cores;
+         workers = nextThreadCount(workers, cores)){
+        SessionEngine* engine = sessionEngineCreate(table, numSessions, workers);
+        pthread_t threads[workers];
+        Producer producers[workers];
+        double begin = seconds();
+        sessionEngineStart(engine);
+        for (int p = 0; p < workers; p++){
+            producers[p] = (Producer){engine, numSessions, numInputs,
+                                      events / workers, 0x9e3779b97f4a7c15ULL + p};
+            pthread_create(&threads[p], NULL, producerMain, &producers[p]);
+        }
+        for (int p = 0; p < workers; p++){
+            pthread_join(threads[p], NULL);
+        }
+        sessionEngineFinish(engine);
+        double elapsed = seconds() - begin;
+        printf("%3d workers: %12.0f events/s\n", workers,
+               (events / workers) * workers / elapsed);
+        sessionEngineFree(engine);
+    }
+
+    freeFSMTable(table);
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+}
+
+//prints the outcome of a run the same way getState and moveOne do
+void printRunResult(const FSMTable* table, int curState, long long step,
+                    int status, char input){
+    if (status == RUN_INVALID_INPUT){
+        printf("Error: %c is invalid input\n", input);
+    }
+    else if (status == RUN_DEAD_END){
+        printf("Error detecting state-input match for state:%d input:%c\n",
+               table->stateIds[curState], input);
+    }
+    else if (status == RUN_READ_ERROR){
+        printf("Error reading input file after %lld steps\n", step);
+    }
+    else{
+        printf("after %lld steps, state machine finished successfully at state %d\n",
+               step, table->stateIds[curState]);
+    }
+}
+
+//background thread: writes each full buffer handed over by traceRecord
+static void* traceWriterMain(void* arg){
+    TraceWriter* writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    for (;;){
+        while (!writer->pending && !writer->done){
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        }
+        if (!writer->pending){
+            break; //done, and nothing left to write
+        }
+        unsigned char* buffer = writer->pending;
+        size_t size = writer->pendingSize;
+        pthread_mutex_unlock(&writer->lock);
+        int failed = fwrite(buffer, 1, size, writer->file) != size;
+        int error = errno;
+        pthread_mutex_lock(&writer->lock);
+        if (failed && !writer->error){
+            writer->error = error;
+        }
+        writer->pending = NULL;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+//gives the filled buffer to the writer thread and switches to the other one
+static void traceHandOff(TraceWriter* writer){
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending){
+        pthread_cond_wait(&writer->cond, &writer->lock); //writer is behind
+    }
+    writer->pending = writer->buffers[writer->filling];
+    writer->pendingSize = writer->used;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    writer->filling = !writer->filling;
+    writer->used = 0;
+}
+
+//opens a trace file for writing and starts the writer thread
+TraceWriter* traceCreate(const char* file, int startState){
+    TraceWriter* writer = calloc(1, sizeof(TraceWriter));
+    writer->file = fopen(file, "wb");
+    if (!writer->file){
+        printf("Error writing trace file\n");
+        exit(0);
+    }
+    TraceHeader header = {TRACE_MAGIC, TRACE_INTERVAL, startState};
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1){
+        writer->error = errno;
+    }
+    writer->offset = sizeof(header);
+    writer->lastState = startState;
+    writer->buffers[0] = malloc(TRACE_BUFFER);
+    writer->buffers[1] = malloc(TRACE_BUFFER);
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    pthread_create(&writer->thread, NULL, traceWriterMain, writer);
+    return writer;
+}
+
+//records one step: the input, and the state id it led to
+void traceRecord(TraceWriter* writer, char input, int state){
+    //every interval steps, remember where we are for seeking
+    if (writer->steps % TRACE_INTERVAL == 0){
+        if (writer->indexCount == writer->indexCapacity){
+            writer->indexCapacity = writer->indexCapacity ? writer->indexCapacity * 2
+                                                          : 1024;
+            writer->index = realloc(writer->index,
+                                    sizeof(TraceIndexEntry) * writer->indexCapacity);
+        }
+        TraceIndexEntry entry = {writer->offset, writer->lastState, 0};
+        writer->index[writer->indexCount++] = entry;
+    }
+
+    //a record is at most 1 + 5 bytes
+    if (writer->used + 6 > TRACE_BUFFER){
+        traceHandOff(writer);
+    }
+    unsigned char* out = writer->buffers[writer->filling] + writer->used;
+    unsigned char* begin = out;
+    *out++ = (unsigned char)input;
+    //zigzag maps small negative and positive changes to small numbers
+    int32_t delta = (int32_t)((uint32_t)state - (uint32_t)writer->lastState);
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    while (zigzag >= 0x80){
+        *out++ = (unsigned char)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    *out++ = (unsigned char)zigzag;
+
+    writer->used += out - begin;
+    writer->offset += out - begin;
+    writer->lastState = state;
+    writer->steps++;
+}
+
+//flushes the last records, writes the index and footer and closes the file.
+//returns the errno of the first write that failed, 0 if none did
+int traceClose(TraceWriter* writer, int status, char badInput){
+    traceHandOff(writer);
+    pthread_mutex_lock(&writer->lock);
+    writer->done = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    //records have different lengths, so pad to keep the index and footer
+    //aligned when the file is mapped for replay
+    static const char padding[8] = {0};
+    size_t pad = (8 - writer->offset % 8) % 8;
+    int ok = fwrite(padding, 1, pad, writer->file) == pad;
+    writer->offset += pad;
+    TraceFooter footer = {writer->steps, writer->offset, writer->indexCount,
+                          status, (unsigned char)badInput, TRACE_MAGIC};
+    if (writer->indexCount){
+        ok = ok && fwrite(writer->index, sizeof(TraceIndexEntry),
+                          writer->indexCount, writer->file) == writer->indexCount;
+    }
+    ok = ok && fwrite(&footer, sizeof(footer), 1, writer->file) == 1;
+    if (!ok && !writer->error){
+        writer->error = errno;
+    }
+    //buffered bytes are only written, and can only fail, here
+    if (fclose(writer->file) != 0 && !writer->error){
+        writer->error = errno;
+    }
+    int error = writer->error;
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    free(writer->index);
+    free(writer);
+    return error;
+}
+
+//like runTable, but records every step in a trace
+int runTraced(const FSMTable* table, const char* inputOrder, long long length2,
+              TraceWriter* writer, long long* step, int* status){
+    int curState = table->start;
+    long long i;
+    *status = RUN_OK;
+    for (i = 0; i < length2; i++){
+        int cls = table->classOf[(unsigned char)inputOrder[i]];
+        if (cls < 0){
+            *status = RUN_INVALID_INPUT;
+            break;
+        }
+        int nextState = table->next[(size_t)curState * table->numClasses + cls];
+        if (nextState == table->dead){
+            *status = RUN_DEAD_END;
+            break;
+        }
+        curState = nextState;
+        traceRecord(writer, inputOrder[i], table->stateIds[curState]);
+    }
+    *step = i;
+    return curState;
+}
+
+//maps a trace file into memory and checks its header, footer and index
+//against each other and the file size, so replay never reads past the
+//records. returns 0 if the file is not a valid trace
+int traceOpen(TraceReader* reader, const char* file){
+    int fd = open(file, O_RDONLY);
+    if (fd < 0){
+        return 0;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    reader->size = info.st_size;
+    if (reader->size < sizeof(TraceHeader) + sizeof(TraceFooter)){
+        close(fd);
+        return 0;
+    }
+    reader->data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (reader->data == MAP_FAILED){
+        return 0;
+    }
+    reader->header = (const TraceHeader*)reader->data;
+    reader->footer = (const TraceFooter*)(reader->data + reader->size
+                                          - sizeof(TraceFooter));
+    const TraceHeader* header = reader->header;
+    const TraceFooter* footer = reader->footer;
+    uint64_t records = reader->size - sizeof(TraceFooter);
+    int ok = !memcmp(header->magic, TRACE_MAGIC, 8)
+             && !memcmp(footer->magic, TRACE_MAGIC, 8)
+             && header->interval > 0
+             && reader->size % 8 == 0 //traceClose aligns the index and footer
+             && footer->indexCount <= records / sizeof(TraceIndexEntry)
+             && footer->indexOffset >= sizeof(TraceHeader)
+             && footer->indexOffset + footer->indexCount * sizeof(TraceIndexEntry)
+                == records
+             //every record takes at least 2 bytes, and there is an index
+             //entry before every interval-th record
+             && footer->steps <= (footer->indexOffset - sizeof(TraceHeader)) / 2
+             && footer->indexCount == (footer->steps + header->interval - 1)
+                                      / header->interval;
+    if (ok){
+        reader->index = (const TraceIndexEntry*)(reader->data
+                                                 + footer->indexOffset);
+        //each entry must point at a record, after the previous one
+        uint64_t last = sizeof(TraceHeader);
+        for (uint64_t i = 0; i < footer->indexCount && ok; i++){
+            uint64_t offset = reader->index[i].offset;
+            ok = i ? offset > last && offset < footer->indexOffset
+                   : offset == sizeof(TraceHeader);
+            last = offset;
+        }
+    }
+    if (!ok){
+        munmap(reader->data, reader->size);
+        return 0;
+    }
+    return 1;
+}
+
+void traceCloseReader(TraceReader* reader){
+    munmap(reader->data, reader->size);
+}
+
+//decodes the next record. returns 0 at the end of the trace, or if the
+//record runs into the index or is longer than traceRecord writes
+int traceNext(const TraceReader* reader, TraceCursor* cursor){
+    const unsigned char* end = reader->data + reader->footer->indexOffset;
+    if (cursor->step >= reader->footer->steps
+        || cursor->offset + 2 > reader->footer->indexOffset){
+        return 0;
+    }
+    const unsigned char* in = reader->data + cursor->offset;
+    const unsigned char* begin = in;
+    char input = (char)*in++;
+    uint32_t zigzag = 0;
+    int shift = 0;
+    while (*in & 0x80){
+        if (shift == 28 || in + 1 == end){
+            return 0;
+        }
+        zigzag |= (uint32_t)(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    zigzag |= (uint32_t)*in++ << shift;
+    int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    cursor->input = input;
+    cursor->prevState = cursor->state;
+    cursor->state = (int)((uint32_t)cursor->state + (uint32_t)delta);
+    cursor->offset += in - begin;
+    cursor->step++;
+    return 1;
+}
+
+//moves the cursor to any step: jumps to the index entry at or before it,
+//then decodes at most interval records forward
+void traceSeek(const TraceReader* reader, TraceCursor* cursor, uint64_t step){
+    if (step > reader->footer->steps){
+        step = reader->footer->steps;
+    }
+    uint64_t entry = step / reader->header->interval;
+    if (entry >= reader->footer->indexCount){
+        entry = reader->footer->indexCount ? reader->footer->indexCount - 1 : 0;
+    }
+    if (reader->footer->indexCount){
+        cursor->step = entry * reader->header->interval;
+        cursor->state = reader->index[entry].state;
+        cursor->offset = reader->index[entry].offset;
+    }
+    else{
+        cursor->step = 0;
+        cursor->state = reader->header->startState;
+        cursor->offset = sizeof(TraceHeader);
+    }
+    cursor->input = 0;
+    cursor->prevState = cursor->state;
+    while (cursor->step < step){
+        if (!traceNext(reader, cursor)){
+            break; //the records end early
+        }
+    }
+}
+
+//debugger over a recorded trace: steps forward and backward and jumps to
+//any step without re-running the FSM
+void replayDebugger(const char* file){
+    TraceReader reader;
+    if (!traceOpen(&reader, file)){
+        printf("Error reading trace file\n");
+        exit(0);
+    }
+    printf("processing FSM trace file %s\n", file);
+    printf("trace has %llu steps\n", (unsigned long long)reader.footer->steps);
+
+    TraceCursor cursor;
+    traceSeek(&reader, &cursor, 0);
+    char line[64];
+    for (;;){
+        printf("FSM replay>");
+        if (!fgets(line, sizeof(line), stdin)){
+            break;
+        }
+        unsigned long long target;
+
+        //if the user typed p, print the current step and state
+        if (line[0] == 'p'){
+            printf("at step %llu the FSM is in state %d\n",
+                   (unsigned long long)cursor.step, cursor.state);
+        }
+
+        //if the user typed n, move forward one step
+        else if (line[0] == 'n'){
+            if (traceNext(&reader, &cursor)){
+                printf("at step %llu, input %c transitions FSM from state %d "
+                       "to state %d\n", (unsigned long long)cursor.step - 1,
+                       cursor.input, cursor.prevState, cursor.state);
+            }
+            else if (cursor.step < reader.footer->steps){
+                printf("Error: the record of step %llu is damaged\n",
+                       (unsigned long long)cursor.step);
+            }
+            else if (reader.footer->status == RUN_INVALID_INPUT){
+                printf("end of trace: the run stopped because %c is invalid "
+                       "input\n", reader.footer->badInput);
+            }
+            else if (reader.footer->status == RUN_DEAD_END){
+                printf("end of trace: the run stopped with no match for "
+                       "state:%d input:%c\n", cursor.state,
+                       reader.footer->badInput);
+            }
+            else{
+                printf("end of trace: state machine finished successfully at "
+                       "state %d\n", cursor.state);
+            }
+        }
+
+        //if the user typed b, move back one step
+        else if (line[0] == 'b'){
+            if (cursor.step == 0){
+                printf("already at the start of the trace\n");
+            }
+            else{
+                traceSeek(&reader, &cursor, cursor.step - 1);
+                printf("back at step %llu, the FSM is in state %d\n",
+                       (unsigned long long)cursor.step, cursor.state);
+            }
+        }
+
+        //if the user typed g and a step number, jump to that step
+        else if (line[0] == 'g' && sscanf(line + 1, "%llu", &target) == 1){
+            traceSeek(&reader, &cursor, target);
+            printf("at step %llu the FSM is in state %d\n",
+                   (unsigned long long)cursor.step, cursor.state);
+        }
+
+        else if (line[0] == 'q'){
+            break;
+        }
+
+        //if the user typed anything else, print this prompt
+        else{
+            printf("Error: invalid input. Enter p to print current state, "
+                   "n to move one step forward, b to move one step back, "
+                   "g N to go to step N or q to quit.\n");
+        }
+    }
+    traceCloseReader(&reader);
+}
+
+//runs the compiled table from step until stopStep without printing.
+//stops early when the FSM enters a state flagged in stateBreak (returns 1)
+//or is about to use an input flagged in inputBreak (returns 2).
+//the input breakpoint is ignored for the first step, so continuing from
+//an input breakpoint moves forward. returns 0 if nothing fired
+int runToBreak(const FSMTable* table, const char* inputOrder, int length2,
+               int* curState, int* step, int stopStep, const char* stateBreak,
+               const char* inputBreak, int* status){
+    int state = *curState;
+    int i = *step;
+    int reason = 0;
+    *status = RUN_OK;
+    if (stopStep > length2){
+        stopStep = length2;
+    }
+    while (i < stopStep){
+        unsigned char c = inputOrder[i];
+        if (inputBreak[c] && i != *step){
+            reason = 2;
+            break;
+        }
+        int cls = table->classOf[c];
+        if (cls < 0){
+            *status = RUN_INVALID_INPUT;
+            break;
+        }
+        int nextState = table->next[(size_t)state * table->numClasses + cls];
+        if (nextState == table->dead){
+            *status = RUN_DEAD_END;
+            break;
+        }
+        state = nextState;
+        i++;
+        if (stateBreak[state]){
+            reason = 1;
+            break;
+        }
+    }
+    *curState = state;
+    *step = i;
+    return reason;
+}
+
+//compiles a definition for NFA simulation: every transition is kept,
+//and epsilon closures are folded into the per-input successor sets
+NFATable* compileNFA(int length, int* curStateList, char* inputList,
+                     int* nextStateList){
+    NFATable* nfa = calloc(1, sizeof(NFATable));
+    nfa->stateIds = malloc(sizeof(int) * (2 * length + 1));
+
+    //number the states the same way compileFSM does, state 0 first
+    IntMap ids;
+    intMapInit(&ids, 2 * length + 1);
+    nfa->stateIds[nfa->numStates++] = 0;
+    intMapPut(&ids, 0, 0);
+    for (int i = 0; i < 2 * length; i++){
+        int id = (i % 2) ? nextStateList[i / 2] : curStateList[i / 2];
+        if (intMapGet(&ids, id) < 0){
+            intMapPut(&ids, id, nfa->numStates);
+            nfa->stateIds[nfa->numStates++] = id;
+        }
+    }
+    for (int c = 0; c < 256; c++){
+        nfa->classOf[c] = -1;
+    }
+    for (int i = 0; i < length; i++){
+        unsigned char c = inputList[i];
+        if (c != EPSILON && nfa->classOf[c] < 0){
+            nfa->classChar[nfa->numClasses] = c;
+            nfa->classOf[c] = nfa->numClasses++;
+        }
+    }
+    int n = nfa->numStates;
+    int words = nfa->words = (n + 63) / 64;
+
+    size_t succWords = (size_t)nfa->numClasses * n * words;
+    if (succWords > ((size_t)1 << 31)){
+        printf("Error: NFA has too many states for bitset simulation\n");
+        exit(0);
+    }
+
+    //epsilon successors of each state, as adjacency lists
+    int* epsStart = calloc(n + 1, sizeof(int));
+    for (int i = 0; i < length; i++){
+        if (inputList[i] == EPSILON){
+            epsStart[intMapGet(&ids, curStateList[i]) + 1]++;
+        }
+    }
+    for (int s = 0; s < n; s++){
+        epsStart[s + 1] += epsStart[s];
+    }
+    int* epsNext = malloc(sizeof(int) * (epsStart[n] ? epsStart[n] : 1));
+    int* fill = malloc(sizeof(int) * n);
+    memcpy(fill, epsStart, sizeof(int) * n);
+    for (int i = 0; i < length; i++){
+        if (inputList[i] == EPSILON){
+            epsNext[fill[intMapGet(&ids, curStateList[i])]++] =
+                    intMapGet(&ids, nextStateList[i]);
+        }
+    }
+
+    //epsilon closure of each state, by depth-first search
+    uint64_t* closure = calloc((size_t)n * words, sizeof(uint64_t));
+    int* stack = malloc(sizeof(int) * (epsStart[n] + 1));
+    for (int s = 0; s < n; s++){
+        uint64_t* set = closure + (size_t)s * words;
+        int top = 0;
+        set[s / 64] |= 1ULL << (s % 64);
+        stack[top++] = s;
+        while (top){
+            int t = stack[--top];
+            for (int e = epsStart[t]; e < epsStart[t + 1]; e++){
+                int u = epsNext[e];
+                if (!(set[u / 64] & (1ULL << (u % 64)))){
+                    set[u / 64] |= 1ULL << (u % 64);
+                    stack[top++] = u;
+                }
+            }
+        }
+    }
+
+    //state s on input c goes to the closures of all its c successors
+    nfa->succ = calloc(succWords ? succWords : 1, sizeof(uint64_t));
+    for (int i = 0; i < length; i++){
+        if (inputList[i] == EPSILON){
+            continue;
+        }
+        int cls = nfa->classOf[(unsigned char)inputList[i]];
+        uint64_t* set = nfa->succ + ((size_t)cls * n
+                                     + intMapGet(&ids, curStateList[i])) * words;
+        const uint64_t* add = closure + (size_t)intMapGet(&ids, nextStateList[i])
+                                        * words;
+        for (int w = 0; w < words; w++){
+            set[w] |= add[w];
+        }
+    }
+    nfa->startSet = malloc(sizeof(uint64_t) * words);
+    memcpy(nfa->startSet, closure, sizeof(uint64_t) * words);
+
+    free(epsStart);
+    free(epsNext);
+    free(fill);
+    free(closure);
+    free(stack);
+    intMapFree(&ids);
+    return nfa;
+}
+
+void freeNFATable(NFATable* nfa){
+    free(nfa->stateIds);
+    free(nfa->startSet);
+    free(nfa->succ);
+    free(nfa);
+}
+
+//moves a state set forward on one input class: ORs together the
+//successor sets of every active state. returns 0 if the result is empty
+static int nfaStep(const NFATable* nfa, const uint64_t* set, int cls,
+                   uint64_t* next){
+    int words = nfa->words;
+    const uint64_t* rows = nfa->succ + (size_t)cls * nfa->numStates * words;
+    uint64_t any = 0;
+    memset(next, 0, sizeof(uint64_t) * words);
+    for (int w = 0; w < words; w++){
+        uint64_t bits = set[w];
+        while (bits){
+            const uint64_t* row = rows + (size_t)(w * 64 + __builtin_ctzll(bits))
+                                         * words;
+            for (int k = 0; k < words; k++){
+                next[k] |= row[k];
+            }
+            bits &= bits - 1;
+        }
+    }
+    for (int k = 0; k < words; k++){
+        any |= next[k];
+    }
+    return any != 0;
+}
+
+//runs the inputs through the NFA. set holds the starting set (usually
+//startSet) and is updated to the final one; if the run stops on an error
+//it holds the set before the failing input.
+//returns the number of states in the final set
+int runNFA(const NFATable* nfa, const char* inputOrder, long long length2,
+           uint64_t* set, long long* step, int* status){
+    int words = nfa->words;
+    uint64_t* next = malloc(sizeof(uint64_t) * words);
+    long long i;
+    *status = RUN_OK;
+    for (i = 0; i < length2; i++){
+        int cls = nfa->classOf[(unsigned char)inputOrder[i]];
+        if (cls < 0){
+            *status = RUN_INVALID_INPUT;
+            break;
+        }
+        if (!nfaStep(nfa, set, cls, next)){
+            *status = RUN_DEAD_END;
+            break;
+        }
+        memcpy(set, next, sizeof(uint64_t) * words);
+    }
+    free(next);
+    *step = i;
+    int count = 0;
+    for (int w = 0; w < words; w++){
+        count += __builtin_popcountll(set[w]);
+    }
+    return count;
+}
+
+static uint64_t hashSet(const uint64_t* set, int words){
+    uint64_t h = 1469598103934665603ULL;
+    for (int w = 0; w < words; w++){
+        h = (h ^ set[w]) * 1099511628211ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+//sets up an empty DFA cache using at most maxBytes
+void lazyDFAInit(LazyDFA* dfa, const NFATable* nfa, size_t maxBytes){
+    memset(dfa, 0, sizeof(LazyDFA));
+    dfa->nfa = nfa;
+    //each DFA state costs its set, its row of transitions,
+    //and 2 hash table entries
+    size_t perState = sizeof(uint64_t) * nfa->words + sizeof(int) * nfa->numClasses
+                      + 2 * sizeof(int) + 1;
+    size_t maxStates = maxBytes / perState;
+    dfa->maxStates = maxStates < 2 ? 2 : (maxStates > (1 << 28) ? (1 << 28)
+                                                                : (int)maxStates);
+    dfa->scratch = malloc(sizeof(uint64_t) * 2 * nfa->words);
+}
+
+//finds a set's DFA state, or the empty hash slot where it would go
+static int lazyFind(const LazyDFA* dfa, const uint64_t* set, int* slot){
+    int words = dfa->nfa->words;
+    int h = (int)(hashSet(set, words) & (dfa->hashCapacity - 1));
+    while (dfa->hash[h] >= 0){
+        if (!memcmp(dfa->sets + (size_t)dfa->hash[h] * words, set,
+                    sizeof(uint64_t) * words)){
+            break;
+        }
+        h = (h + 1) & (dfa->hashCapacity - 1);
+    }
+    *slot = h;
+    return dfa->hash[h];
+}
+
+//adds a new DFA state for a set. the caller makes sure count < maxStates
+static int lazyAdd(LazyDFA* dfa, const uint64_t* set){
+    int words = dfa->nfa->words;
+    int classes = dfa->nfa->numClasses;
+
+    //grow by doubling, up to maxStates
+    if (dfa->count == dfa->capacity){
+        int capacity = dfa->capacity ? dfa->capacity * 2 : 64;
+        if (capacity > dfa->maxStates){
+            capacity = dfa->maxStates;
+        }
+        dfa->capacity = capacity;
+        dfa->sets = realloc(dfa->sets, sizeof(uint64_t) * words * capacity);
+        dfa->next = realloc(dfa->next, sizeof(int) * classes * (size_t)capacity);
+        free(dfa->hash);
+        dfa->hashCapacity = 16;
+        while (dfa->hashCapacity < capacity * 2){
+            dfa->hashCapacity *= 2;
+        }
+        dfa->hash = malloc(sizeof(int) * dfa->hashCapacity);
+        memset(dfa->hash, -1, sizeof(int) * dfa->hashCapacity);
+        for (int i = 0; i < dfa->count; i++){
+            int slot;
+            lazyFind(dfa, dfa->sets + (size_t)i * words, &slot);
+            dfa->hash[slot] = i;
+        }
+    }
+
+    int state = dfa->count++;
+    int slot;
+    memcpy(dfa->sets + (size_t)state * words, set, sizeof(uint64_t) * words);
+    memset(dfa->next + (size_t)state * classes, -1, sizeof(int) * classes);
+    lazyFind(dfa, set, &slot);
+    dfa->hash[slot] = state;
+    return state;
+}
+
+//throws away every DFA state built so far
+static void lazyFlush(LazyDFA* dfa){
+    dfa->count = 0;
+    memset(dfa->hash, -1, sizeof(int) * dfa->hashCapacity);
+    dfa->flushes++;
+}
+
+//returns the DFA state for the NFA's start set
+int lazyDFAStart(LazyDFA* dfa){
+    int slot;
+    if (dfa->count){
+        int state = lazyFind(dfa, dfa->nfa->startSet, &slot);
+        if (state >= 0){
+            return state;
+        }
+        if (dfa->count >= dfa->maxStates){
+            lazyFlush(dfa);
+        }
+    }
+    return lazyAdd(dfa, dfa->nfa->startSet);
+}
+
+//returns the DFA state reached from *state on input class cls, building
+//it if needed. a flush renumbers states, so *state is updated too
+int lazyDFAStep(LazyDFA* dfa, int* current, int cls){
+    int classes = dfa->nfa->numClasses;
+    int words = dfa->nfa->words;
+    int state = *current;
+    int next = dfa->next[(size_t)state * classes + cls];
+    if (next >= 0){
+        return next;
+    }
+
+    uint64_t* set = dfa->scratch;
+    nfaStep(dfa->nfa, dfa->sets + (size_t)state * words, cls, set);
+    int slot;
+    next = dfa->count ? lazyFind(dfa, set, &slot) : -1;
+    if (next < 0){
+        if (dfa->count >= dfa->maxStates){
+            //cache full: start over, keeping only the current state
+            uint64_t* kept = dfa->scratch + words;
+            memcpy(kept, dfa->sets + (size_t)state * words,
+                   sizeof(uint64_t) * words);
+            lazyFlush(dfa);
+            state = *current = lazyAdd(dfa, kept);
+            next = lazyFind(dfa, set, &slot);
+        }
+        if (next < 0){
+            next = lazyAdd(dfa, set);
+        }
+    }
+    dfa->next[(size_t)state * classes + cls] = next;
+    return next;
+}
+
+//runs the inputs through the lazy DFA from state. returns the final DFA
+//state, or the state before the failing input if the run stops on an error
+int runLazyDFA(LazyDFA* dfa, const char* inputOrder, long long length2,
+               int state, long long* step, int* status){
+    int words = dfa->nfa->words;
+    long long i;
+    *status = RUN_OK;
+    for (i = 0; i < length2; i++){
+        int cls = dfa->nfa->classOf[(unsigned char)inputOrder[i]];
+        if (cls < 0){
+            *status = RUN_INVALID_INPUT;
+            break;
+        }
+        int next = lazyDFAStep(dfa, &state, cls);
+        const uint64_t* set = dfa->sets + (size_t)next * words;
+        uint64_t any = 0;
+        for (int w = 0; w < words; w++){
+            any |= set[w];
+        }
+        if (!any){
+            *status = RUN_DEAD_END;
+            break;
+        }
+        state = next;
+    }
+    *step = i;
+    return state;
+}
+
+void lazyDFAFree(LazyDFA* dfa){
+    free(dfa->sets);
+    free(dfa->next);
+    free(dfa->hash);
+    free(dfa->scratch);
+}
+
+//prints the state ids in a set, separated by spaces
+void printStateSet(const NFATable* nfa, const uint64_t* set){
+    for (int s = 0; s < nfa->numStates; s++){
+        if (set[s / 64] & (1ULL << (s % 64))){
+            printf(" %d", nfa->stateIds[s]);
+        }
+    }
+}
+
+//runs a nondeterministic FSM and prints the states it finishes in
+void runNondeterministic(const Options* options, int length, int* curStateList,
+                         char* inputList, int* nextStateList,
+                         int length2, char* inputOrder){
+    NFATable* nfa = compileNFA(length, curStateList, inputList, nextStateList);
+    uint64_t* set = malloc(sizeof(uint64_t) * nfa->words);
+    long long step;
+    int status;
+    LazyDFA dfa;
+
+    if (options->dfaCacheMB > 0){
+        lazyDFAInit(&dfa, nfa, (size_t)options->dfaCacheMB << 20);
+        int state = runLazyDFA(&dfa, inputOrder, length2, lazyDFAStart(&dfa),
+                               &step, &status);
+        memcpy(set, dfa.sets + (size_t)state * nfa->words,
+               sizeof(uint64_t) * nfa->words);
+        printf("DFA cache built %d states, flushed %lld times\n",
+               dfa.count, dfa.flushes);
+        lazyDFAFree(&dfa);
+    }
+    else{
+        memcpy(set, nfa->startSet, sizeof(uint64_t) * nfa->words);
+        runNFA(nfa, inputOrder, length2, set, &step, &status);
+    }
+
+    if (status == RUN_INVALID_INPUT){
+        printf("Error: %c is invalid input\n", inputOrder[step]);
+    }
+    else if (status == RUN_DEAD_END){
+        printf("Error detecting state-input match for states:");
+        printStateSet(nfa, set);
+        printf(" input:%c\n", inputOrder[step]);
+    }
+    else{
+        printf("after %lld steps, state machine finished successfully "
+               "in states:", step);
+        printStateSet(nfa, set);
+        printf("\n");
+    }
+    free(set);
+    freeNFATable(nfa);
+}
+
+//first free entry of a comb table at or after i. used entries point
+//past themselves, and lookups halve the paths they follow. entries from
+//capacity on are all free
+static int combFree(int* nextFree, int capacity, int i){
+    while (i < capacity && nextFree[i] != i){
+        nextFree[i] = nextFree[nextFree[i]];
+        i = nextFree[i];
+    }
+    return i;
+}
+
+//packs a dense table into default transitions plus exceptions.
+//each state's default is its most common next state, and rows are placed
+//first-fit into the shared arrays, the rows with most exceptions first.
+//the search is bounded, so a machine whose rows don't fit together can
+//come out bigger than the dense table; callers compare the sizes
+CombTable* compressFSM(const FSMTable* table){
+    CombTable* comb = calloc(1, sizeof(CombTable));
+    int rows = table->numStates + 1;
+    int classes = table->numClasses;
+    comb->numStates = table->numStates;
+    comb->numClasses = classes;
+    comb->dead = table->dead;
+    comb->start = table->start;
+    comb->stateIds = malloc(sizeof(int) * (table->numStates ? table->numStates : 1));
+    memcpy(comb->stateIds, table->stateIds, sizeof(int) * table->numStates);
+    memcpy(comb->classOf, table->classOf, sizeof(comb->classOf));
+    memcpy(comb->classChar, table->classChar, sizeof(comb->classChar));
+    comb->base = calloc(rows, sizeof(int));
+    comb->defaults = malloc(sizeof(int) * rows);
+
+    //pick each state's default: the most common next state in its row
+    int* exceptions = calloc(rows, sizeof(int));
+    IntMap counts;
+    intMapInit(&counts, classes);
+    for (int s = 0; s < rows; s++){
+        const int* row = table->next + (size_t)s * classes;
+        int best = table->dead, bestCount = 0;
+        counts.count = 0;
+        memset(counts.used, 0, counts.capacity);
+        for (int c = 0; c < classes; c++){
+            int n = intMapGet(&counts, row[c]) + 1;
+            n = n ? n : 1; //absent keys read as -1
+            intMapPut(&counts, row[c], n);
+            if (n > bestCount){
+                best = row[c];
+                bestCount = n;
+            }
+        }
+        comb->defaults[s] = best;
+        exceptions[s] = classes - bestCount;
+    }
+    intMapFree(&counts);
+
+    //place the rows with most exceptions first, while there is most room
+    int* order = malloc(sizeof(int) * rows);
+    int placed = 0;
+    for (int k = classes; k > 0; k--){
+        for (int s = 0; s < rows; s++){
+            if (exceptions[s] == k){
+                order[placed++] = s;
+            }
+        }
+    }
+
+    //the arrays grow as needed; they always cover base+class for every
+    //state, so a state with no exceptions can use base 0.
+    //nextFree skips over used entries, see combFree
+    int capacity = classes * 2 + 64;
+    comb->next = malloc(sizeof(int) * capacity);
+    comb->check = malloc(sizeof(int) * capacity);
+    memset(comb->check, -1, sizeof(int) * capacity);
+    int* cols = malloc(sizeof(int) * classes); //exception classes of a row
+    int* nextFree = malloc(sizeof(int) * (capacity + 1));
+    for (int i = 0; i <= capacity; i++){
+        nextFree[i] = i;
+    }
+    comb->size = classes;
+    int searchFrom = 0; //searches start at the first free entry from here
+    for (int p = 0; p < placed; p++){
+        int s = order[p];
+        const int* row = table->next + (size_t)s * classes;
+        int numCols = 0;
+        for (int c = 0; c < classes; c++){
+            if (row[c] != comb->defaults[s]){
+                cols[numCols++] = c;
+            }
+        }
+        int firstCol = cols[0];
+        //try bases that put the first exception on a free entry, at most
+        //COMB_SEARCH_LIMIT of them. rows that are mostly exceptions would
+        //rarely fit in a gap, so they go straight to the end.
+        //base can't be negative, since every class is looked up
+        int base = -1;
+        if (exceptions[s] <= classes / 2){
+            int slot = combFree(nextFree, capacity,
+                                searchFrom > firstCol ? searchFrom : firstCol);
+            for (int tries = 0; tries < COMB_SEARCH_LIMIT && base < 0; tries++){
+                int fits = 1;
+                for (int k = 1; k < numCols && fits; k++){
+                    int entry = slot - firstCol + cols[k];
+                    if (entry < capacity && comb->check[entry] >= 0){
+                        fits = 0;
+                    }
+                }
+                if (fits){
+                    base = slot - firstCol;
+                }
+                slot = combFree(nextFree, capacity, slot + 1);
+            }
+            //the free entries this search passed are too scattered to
+            //be worth trying again
+            if (base < 0){
+                searchFrom = slot;
+            }
+        }
+        //every entry from size on is free
+        if (base < 0){
+            base = comb->size > firstCol ? comb->size - firstCol : 0;
+        }
+        while (base + classes > capacity){
+            comb->next = realloc(comb->next, sizeof(int) * capacity * 2);
+            comb->check = realloc(comb->check, sizeof(int) * capacity * 2);
+            memset(comb->check + capacity, -1, sizeof(int) * capacity);
+            nextFree = realloc(nextFree, sizeof(int) * (capacity * 2 + 1));
+            for (int i = capacity; i <= capacity * 2; i++){
+                nextFree[i] = i;
+            }
+            capacity *= 2;
+        }
+        for (int k = 0; k < numCols; k++){
+            int c = cols[k];
+            comb->next[base + c] = row[c];
+            comb->check[base + c] = s;
+            nextFree[base + c] = base + c + 1;
+        }
+        comb->base[s] = base;
+        if (base + classes > comb->size){
+            comb->size = base + classes;
+        }
+    }
+    //unused entries are never read as a match, but give them a value
+    for (int i = 0; i < comb->size; i++){
+        if (comb->check[i] < 0){
+            comb->next[i] = comb->dead;
+        }
+    }
+
+    free(exceptions);
+    free(order);
+    free(cols);
+    free(nextFree);
+    return comb;
+}
+
+void freeCombTable(CombTable* comb){
+    free(comb->stateIds);
+    free(comb->base);
+    free(comb->defaults);
+    free(comb->next);
+    free(comb->check);
+    free(comb);
+}
+
+//bytes used by the transitions of a compressed table
+size_t combBytes(const CombTable* comb){
+    return sizeof(int) * (2 * (size_t)(comb->numStates + 1) + 2 * (size_t)comb->size);
+}
+
+//bytes used by the transitions of a dense table
+size_t tableBytes(const FSMTable* table){
+    return sizeof(int) * (size_t)(table->numStates + 1) * table->numClasses;
+}
+
+//like runTable, on a compressed table. each step is still O(1):
+//one check of the state's exception entry, else its default
+int runComb(const CombTable* comb, const char* inputOrder, long long length2,
+            int startState, long long* step, int* status){
+    int curState = startState;
+    long long i;
+    *status = RUN_OK;
+    for (i = 0; i < length2; i++){
+        int cls = comb->classOf[(unsigned char)inputOrder[i]];
+        if (cls < 0){
+            *status = RUN_INVALID_INPUT;
+            break;
+        }
+        int entry = comb->base[curState] + cls;
+        int nextState = comb->check[entry] == curState ? comb->next[entry]
+                                                        : comb->defaults[curState];
+        if (nextState == comb->dead){
+            *status = RUN_DEAD_END;
+            break;
+        }
+        curState = nextState;
+    }
+    *step = i;
+    return curState;
+}
+
+//compares the dense and compressed tables on a machine with a large
+//alphabet where each state sends most inputs to the same next state
+void benchCompress(){
+    int numStates = 4096, numInputs = 200;
+    long long events = 20000000;
+    int length = numStates * numInputs;
+    int* curStateList = malloc(sizeof(int) * length);
+    char* inputList = malloc(length);
+    int* nextStateList = malloc(sizeof(int) * length);
+    unsigned long long seed = 12345;
+    int i = 0;
+    for (int state = 0; state < numStates; state++){
+        int usual = (int)(rngNext(&seed) % numStates);
+        for (int input = 0; input < numInputs; input++){
+            curStateList[i] = state;
+            inputList[i] = (char)(33 + input); //printable and beyond
+            //about 1 input in 32 goes somewhere other than usual
+            nextStateList[i] = rngNext(&seed) % 32 ? usual
+                                                   : (int)(rngNext(&seed) % numStates);
+            i++;
+        }
+    }
+    FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+    CombTable* comb = compressFSM(table);
+    char* inputs = malloc(events);
+    for (long long k = 0; k < events; k++){
+        inputs[k] = (char)(33 + rngNext(&seed) % numInputs);
+    }
+
+    printf("compress benchmark: %d states, %d inputs, %lld events\n",
+           numStates, numInputs, events);
+    printf("dense table:      %10zu bytes\n", tableBytes(table));
+    printf("compressed table: %10zu bytes (%.1fx smaller)\n", combBytes(comb),
+           (double)tableBytes(table) / combBytes(comb));
+
+    long long step;
+    int status;
+    double begin = seconds();
+    int state1 = runTable(table, inputs, events, table->start, &step, &status);
+    double dense = seconds() - begin;
+    begin = seconds();
+    int state2 = runComb(comb, inputs, events, comb->start, &step, &status);
+    double packed = seconds() - begin;
+    printf("dense table:      %6.2f ns/step\n", dense * 1e9 / events);
+    printf("compressed table: %6.2f ns/step%s\n", packed * 1e9 / events,
+           state1 == state2 ? "" : " (MISMATCH)");
+
+    free(inputs);
+    freeCombTable(comb);
+    freeFSMTable(table);
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+}
+
+//a state and how often a profile visited it
+typedef struct {
+    long long visits;
+    int state;
+} StateHeat;
+
+//sorts states by visits, most first, then by state so ties are stable
+static int compareHeat(const void* a, const void* b){
+    const StateHeat* x = a;
+    const StateHeat* y = b;
+    if (x->visits != y->visits){
+        return x->visits > y->visits ? -1 : 1;
+    }
+    return x->state - y->state;
+}
+
+//runs a sample of the inputs and orders the states for cache locality.
+//the hottest state not yet placed starts a chain, which then follows the
+//most used transition out of each state to a state not yet placed, so a
+//hot state's usual successor is usually its neighbor. states the sample
+//never visits keep their order at the end. returns the dense states in
+//their new order
+int* profileLayout(const FSMTable* table, const char* sample, long long length){
+    int n = table->numStates;
+    int classes = table->numClasses;
+    long long* visits = calloc(n + 1, sizeof(long long));
+    long long* edges = calloc((size_t)(n + 1) * classes, sizeof(long long));
+
+    //count state visits and transitions used
+    int state = table->start;
+    visits[state]++;
+    for (long long i = 0; i < length; i++){
+        int cls = table->classOf[(unsigned char)sample[i]];
+        if (cls < 0){
+            break;
+        }
+        int next = table->next[(size_t)state * classes + cls];
+        if (next == table->dead){
+            break;
+        }
+        edges[(size_t)state * classes + cls]++;
+        state = next;
+        visits[state]++;
+    }
+
+    //sort the visited states, hottest first
+    StateHeat* byHeat = malloc(sizeof(StateHeat) * (size_t)(n > 0 ? n : 1));
+    int visited = 0;
+    for (int s = 0; s < n; s++){
+        if (visits[s]){
+            byHeat[visited++] = (StateHeat){visits[s], s};
+        }
+    }
+    qsort(byHeat, visited, sizeof(StateHeat), compareHeat);
+
+    int* order = malloc(sizeof(int) * (size_t)(n > 0 ? n : 1));
+    char* placed = calloc(n + 1, 1);
+    int count = 0;
+    for (int h = 0; h < visited; h++){
+        int s = byHeat[h].state;
+        while (s >= 0 && !placed[s]){
+            placed[s] = 1;
+            order[count++] = s;
+            //follow the most used transition to a state not yet placed
+            int best = -1;
+            long long bestCount = 0;
+            for (int c = 0; c < classes; c++){
+                int next = table->next[(size_t)s * classes + c];
+                long long used = edges[(size_t)s * classes + c];
+                if (next != table->dead && !placed[next] && used > bestCount){
+                    best = next;
+                    bestCount = used;
+                }
+            }
+            s = best;
+        }
+    }
+    for (int s = 0; s < n; s++){
+        if (!placed[s]){
+            order[count++] = s;
+        }
+    }
+
+    free(visits);
+    free(edges);
+    free(byHeat);
+    free(placed);
+    return order;
+}
+
+//builds a copy of a table with its states renumbered: order[i] is the
+//old dense index of new state i. the dead state stays last
+FSMTable* permuteFSM(const FSMTable* table, const int* order){
+    int n = table->numStates;
+    int classes = table->numClasses;
+    FSMTable* permuted = calloc(1, sizeof(FSMTable));
+    *permuted = *table;
+    permuted->remap = NULL;
+    permuted->remapFrom = NULL;
+    permuted->stateIds = malloc(sizeof(int) * (n ? n : 1));
+    permuted->next = malloc(sizeof(int) * (size_t)(n + 1) * (classes ? classes : 1));
+
+    int* newIndex = malloc(sizeof(int) * (n + 1));
+    for (int i = 0; i < n; i++){
+        newIndex[order[i]] = i;
+    }
+    newIndex[table->dead] = table->dead;
+    for (int i = 0; i <= n; i++){
+        int old = i < n ? order[i] : table->dead;
+        if (i < n){
+            permuted->stateIds[i] = table->stateIds[old];
+        }
+        for (int c = 0; c < classes; c++){
+            permuted->next[(size_t)i * classes + c] =
+                    newIndex[table->next[(size_t)old * classes + c]];
+        }
+    }
+    permuted->start = newIndex[table->start];
+    free(newIndex);
+    return permuted;
+}
+
+//reads a layout saved by writeLayout: one state id per line, hottest
+//first. states missing from the file keep their order at the end
+int* readLayout(const FSMTable* table, const char* file){
+    FILE* in = fopen(file, "r");
+    if (!in){
+        printf("Error reading layout file\n");
+        exit(0);
+    }
+    IntMap ids;
+    intMapInit(&ids, table->numStates);
+    for (int i = 0; i < table->numStates; i++){
+        intMapPut(&ids, table->stateIds[i], i);
+    }
+    int* order = malloc(sizeof(int) * (table->numStates ? table->numStates : 1));
+    char* placed = calloc(table->numStates + 1, 1);
+    int count = 0;
+    int id;
+    while (fscanf(in, "%d", &id) == 1){
+        int s = intMapGet(&ids, id);
+        if (s >= 0 && !placed[s]){
+            placed[s] = 1;
+            order[count++] = s;
+        }
+    }
+    for (int s = 0; s < table->numStates; s++){
+        if (!placed[s]){
+            order[count++] = s;
+        }
+    }
+    fclose(in);
+    free(placed);
+    intMapFree(&ids);
+    return order;
+}
+
+//saves a layout as one state id per line
+void writeLayout(const FSMTable* table, const int* order, const char* file){
+    FILE* out = fopen(file, "w");
+    if (!out){
+        printf("Error writing layout file\n");
+        exit(0);
+    }
+    for (int i = 0; i < table->numStates; i++){
+        fprintf(out, "%d\n", table->stateIds[order[i]]);
+    }
+    fclose(out);
+}
+
+//compiles the definition for the table-based modes, applying --profile
+//and --layout if they were given. with no inputs to profile, the plain
+//layout is used and the layout file is left alone
+FSMTable* buildTable(const Options* options, int length, int* curStateList,
+                     char* inputList, int* nextStateList,
+                     int length2, char* inputOrder){
+    FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+    int* order = NULL;
+    if (options->profile > 0){
+        if (length2 > 0){
+            order = profileLayout(table, inputOrder, options->profile < length2
+                                                     ? options->profile : length2);
+        }
+        if (order && options->layout){
+            writeLayout(table, order, options->layout);
+        }
+    }
+    else if (options->layout){
+        order = readLayout(table, options->layout);
+    }
+    if (order){
+        FSMTable* permuted = permuteFSM(table, order);
+        freeFSMTable(table);
+        free(order);
+        table = permuted;
+    }
+    return table;
+}
+
+//opens a hardware counter for last level cache misses in this thread.
+//returns -1 if the kernel doesn't allow it
+static int openCacheMissCounter(){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+//times a run on a table, and counts its cache misses if possible
+static void timeLayout(const char* name, const FSMTable* table,
+                       const char* inputs, long long events){
+    long long step, misses = -1;
+    int status;
+    int counter = openCacheMissCounter();
+    if (counter >= 0){
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    double begin = seconds();
+    int state = runTable(table, inputs, events, table->start, &step, &status);
+    double elapsed = seconds() - begin;
+    if (counter >= 0){
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)){
+            misses = -1;
+        }
+        close(counter);
+    }
+    printf("%-10s %6.2f ns/step, final state %d, ", name,
+           elapsed * 1e9 / events, table->stateIds[state]);
+    if (misses >= 0){
+        printf("%.3f cache misses/step\n", (double)misses / events);
+    }
+    else{
+        printf("cache misses not available\n");
+    }
+}
+
+//compares file order with a profiled layout on a large table where most
+//transitions lead into a small hot set of states scattered through it
+void benchLayout(){
+    int numStates = 1 << 21, numInputs = 4, hot = 16384;
+    long long events = 20000000;
+    int length = numStates * numInputs;
+    int* curStateList = malloc(sizeof(int) * length);
+    char* inputList = malloc(length);
+    int* nextStateList = malloc(sizeof(int) * length);
+    unsigned long long seed = 777;
+    int* hotStates = malloc(sizeof(int) * hot);
+    hotStates[0] = 0;
+    for (int h = 1; h < hot; h++){
+        hotStates[h] = (int)(rngNext(&seed) % numStates);
+    }
+    int i = 0;
+    for (int state = 0; state < numStates; state++){
+        for (int input = 0; input < numInputs; input++){
+            curStateList[i] = state;
+            inputList[i] = (char)('a' + input);
+            //31 transitions in 32 go to a hot state
+            nextStateList[i] = rngNext(&seed) % 32
+                               ? hotStates[rngNext(&seed) % hot]
+                               : (int)(rngNext(&seed) % numStates);
+            i++;
+        }
+    }
+    FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+    free(hotStates);
+    char* inputs = malloc(events);
+    for (long long k = 0; k < events; k++){
+        inputs[k] = (char)('a' + rngNext(&seed) % numInputs);
+    }
+
+    printf("layout benchmark: %d states (%zu byte table), %d hot, %lld events\n",
+           numStates, tableBytes(table), hot, events);
+    //profile on the first 10% of the inputs, then time all of them
+    double begin = seconds();
+    int* order = profileLayout(table, inputs, events / 10);
+    FSMTable* permuted = permuteFSM(table, order);
+    printf("profiling and renumbering took %.3f s\n", seconds() - begin);
+    timeLayout("file order", table, inputs, events);
+    timeLayout("profiled", permuted, inputs, events);
+
+    free(order);
+    free(inputs);
+    freeFSMTable(permuted);
+    freeFSMTable(table);
+}
+
+//reader thread: fills buffers in order, staying at most STREAM_BUFFERS
+//chunks ahead of the FSM, and tells the kernel what it will read next
+static void* streamReaderMain(void* arg){
+    InputStream* stream = arg;
+    long long offset = 0;
+    for (;;){
+        pthread_mutex_lock(&stream->lock);
+        while (stream->produced - stream->consumed == STREAM_BUFFERS
+               && !stream->stop){
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+        int stop = stream->stop;
+        pthread_mutex_unlock(&stream->lock);
+        if (stop){
+            break;
+        }
+
+        //ask for the chunk after this one while this one is read
+        posix_fadvise(stream->fd, offset + STREAM_CHUNK, STREAM_CHUNK,
+                      POSIX_FADV_WILLNEED);
+        char* buffer = stream->buffers[stream->produced % STREAM_BUFFERS];
+        size_t size = 0;
+        int error = 0;
+        while (size < STREAM_CHUNK){
+            ssize_t got = read(stream->fd, buffer + size, STREAM_CHUNK - size);
+            if (got < 0 && errno == EINTR){
+                continue;
+            }
+            if (got < 0){
+                error = errno;
+                break;
+            }
+            if (got == 0){
+                break;
+            }
+            size += got;
+        }
+        offset += size;
+
+        //a read error ends the stream like the end of the file does, after
+        //the chunk read so far, and runStream reports it
+        pthread_mutex_lock(&stream->lock);
+        stream->sizes[stream->produced % STREAM_BUFFERS] = size;
+        stream->produced++;
+        if (size == 0 || error){
+            stream->eof = 1;
+            stream->error = error;
+        }
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+        if (size == 0 || error){
+            break;
+        }
+    }
+    return NULL;
+}
+
+//opens an inputs file and starts reading ahead. returns NULL on error
+InputStream* streamOpen(const char* file){
+    int fd = open(file, O_RDONLY);
+    if (fd < 0){
+        return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return streamOpenFd(fd);
+}
+
+//starts reading ahead from an open fd, such as a pipe. the stream owns
+//the fd and closes it
+InputStream* streamOpenFd(int fd){
+    InputStream* stream = calloc(1, sizeof(InputStream));
+    stream->fd = fd;
+    for (int i = 0; i < STREAM_BUFFERS; i++){
+        stream->buffers[i] = malloc(STREAM_CHUNK);
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    pthread_create(&stream->thread, NULL, streamReaderMain, stream);
+    return stream;
+}
+
+//waits for the next chunk. returns 0 at the end of the file.
+//the chunk stays valid until streamRelease
+int streamNext(InputStream* stream, const char** data, size_t* size){
+    pthread_mutex_lock(&stream->lock);
+    while (stream->produced == stream->consumed && !stream->eof){
+        pthread_cond_wait(&stream->cond, &stream->lock);
+    }
+    int index = stream->consumed % STREAM_BUFFERS;
+    int more = stream->produced > stream->consumed && stream->sizes[index] > 0;
+    pthread_mutex_unlock(&stream->lock);
+    *data = stream->buffers[index];
+    *size = more ? stream->sizes[index] : 0;
+    return more;
+}
+
+//hands the current chunk's buffer back to the reader
+void streamRelease(InputStream* stream){
+    pthread_mutex_lock(&stream->lock);
+    stream->consumed++;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+void streamClose(InputStream* stream){
+    pthread_mutex_lock(&stream->lock);
+    stream->stop = 1;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+    close(stream->fd);
+    for (int i = 0; i < STREAM_BUFFERS; i++){
+        free(stream->buffers[i]);
+    }
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->cond);
+    free(stream);
+}
+
+//runs the FSM over a streamed inputs file. the file is read the way
+//storeInputData reads it with fscanf("%c\n"): the first char is always an
+//input, and after that whitespace only separates inputs
+int runStream(const FSMTable* table, InputStream* stream, long long* step,
+              int* status, char* badInput){
+    int curState = table->start;
+    long long steps = 0;
+    int first = 1;
+    const char* data;
+    size_t size;
+    *status = RUN_OK;
+    *badInput = 0;
+    while (*status == RUN_OK && streamNext(stream, &data, &size)){
+        for (size_t i = 0; i < size; i++){
+            unsigned char c = data[i];
+            int cls = table->classOf[c];
+            if (cls < 0){
+                //definition inputs are never whitespace, so checking for
+                //separators only here keeps them off the fast path
+                if (!first && (c == ' ' || (c >= '\t' && c <= '\r'))){
+                    continue;
+                }
+                *status = RUN_INVALID_INPUT;
+                *badInput = c;
+                break;
+            }
+            first = 0;
+            int nextState = table->next[(size_t)curState * table->numClasses + cls];
+            if (nextState == table->dead){
+                *status = RUN_DEAD_END;
+                *badInput = c;
+                break;
+            }
+            curState = nextState;
+            steps++;
+        }
+        streamRelease(stream);
+    }
+    //streamNext has seen the end, so the reader is done setting error
+    if (*status == RUN_OK && stream->error){
+        *status = RUN_READ_ERROR;
+    }
+    *step = steps;
+    return curState;
+}
+
+//compares running a large inputs file with read-ahead against reading
+//and running it in turn on one thread
+void benchStream(){
+    int numStates = 1024, numInputs = 16;
+    long long events = 100000000;
+    int length = numStates * numInputs;
+    int* curStateList = malloc(sizeof(int) * length);
+    char* inputList = malloc(length);
+    int* nextStateList = malloc(sizeof(int) * length);
+    generateFSM(numStates, numInputs, 5, curStateList, inputList, nextStateList);
+    FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+
+    //write events inputs, one per line like test1.inputs
+    char file[] = "/tmp/fsmbenchXXXXXX";
+    int fd = mkstemp(file);
+    if (fd < 0){
+        printf("Error writing benchmark inputs file\n");
+        freeFSMTable(table);
+        return;
+    }
+    unsigned long long seed = 3;
+    char* chunk = malloc(STREAM_CHUNK);
+    for (long long k = 0; k < events; ){
+        size_t used = 0;
+        for (; used + 2 <= STREAM_CHUNK && k < events; k++){
+            chunk[used++] = (char)('a' + rngNext(&seed) % numInputs);
+            chunk[used++] = '\n';
+        }
+        if (write(fd, chunk, used) != (ssize_t)used){
+            printf("Error writing benchmark inputs file\n");
+            break;
+        }
+    }
+    close(fd);
+    printf("stream benchmark: %lld inputs, %lld MB file\n", events,
+           2 * events >> 20);
+
+    //read a chunk, run it, read the next one
+    long long step = 0;
+    int status;
+    char badInput;
+    fd = open(file, O_RDONLY);
+    double begin = seconds();
+    int state = table->start;
+    ssize_t got;
+    while ((got = read(fd, chunk, STREAM_CHUNK)) > 0){
+        for (ssize_t i = 0; i < got; i += 2){
+            state = table->next[(size_t)state * table->numClasses
+                                + table->classOf[(unsigned char)chunk[i]]];
+            step++;
+        }
+    }
+    double serial = seconds() - begin;
+    close(fd);
+    printf("read then run: %8.1f MB/s, final state %d\n",
+           2 * events / serial / 1e6, table->stateIds[state]);
+
+    begin = seconds();
+    InputStream* stream = streamOpen(file);
+    state = runStream(table, stream, &step, &status, &badInput);
+    streamClose(stream);
+    double streamed = seconds() - begin;
+    printf("read ahead:    %8.1f MB/s, final state %d\n",
+           2 * events / streamed / 1e6, table->stateIds[state]);
+
+    unlink(file);
+    free(chunk);
+    freeFSMTable(table);
+}
+
+//parses one state:input>next or state:>next token the way storeData's
+//sscanf calls do. returns 0 if it isn't valid syntax
+int parseTransition(const char* p, const char* end, int* curState, char* input,
+                    int* nextState){
+    int numbers[2];
+    for (int k = 0; k < 2; k++){
+        int negative = 0;
+        long long value = 0;
+        if (p < end && (*p == '-' || *p == '+')){
+            negative = (*p++ == '-');
+        }
+        if (p == end || *p < '0' || *p > '9'){
+            return 0;
+        }
+        while (p < end && *p >= '0' && *p <= '9'){
+            value = value * 10 + (*p++ - '0');
+        }
+        numbers[k] = (int)(negative ? -value : value);
+
+        if (k == 0){
+            //after the state comes :, then the input and >
+            if (end - p < 3 || *p != ':'){
+                return 0;
+            }
+            p++;
+            if (p[0] == '>' && p[1] != '>'){
+                *input = EPSILON; //state:>next
+                p++;
+            }
+            else if (p[1] == '>'){
+                *input = *p;
+                p += 2;
+            }
+            else{
+                return 0;
+            }
+        }
+    }
+    //an epsilon transition must be the whole token
+    if (*input == EPSILON && p != end){
+        return 0;
+    }
+    *curState = numbers[0];
+    *nextState = numbers[1];
+    return 1;
+}
+
+static int isSeparator(char c){
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+//first phase: parse one chunk into the job's own arrays
+static void* loadParseMain(void* arg){
+    LoadJob* job = arg;
+    const char* p = job->begin;
+    while (p < job->end){
+        while (p < job->end && isSeparator(*p)){
+            p++;
+        }
+        if (p == job->end){
+            break;
+        }
+        const char* token = p;
+        while (p < job->end && !isSeparator(*p)){
+            p++;
+        }
+        if (job->count == job->capacity){
+            job->capacity = job->capacity ? job->capacity * 2 : 4096;
+            job->curStateList = realloc(job->curStateList,
+                                        sizeof(int) * job->capacity);
+            job->inputList = realloc(job->inputList, job->capacity);
+            job->nextStateList = realloc(job->nextStateList,
+                                         sizeof(int) * job->capacity);
+        }
+        if (!parseTransition(token, p, &job->curStateList[job->count],
+                             &job->inputList[job->count],
+                             &job->nextStateList[job->count])){
+            job->syntaxError = 1;
+            break;
+        }
+        job->count++;
+    }
+    return NULL;
+}
+
+//second phase: copy the chunk's transitions to their place in the result
+static void* loadMergeMain(void* arg){
+    LoadJob* job = arg;
+    memcpy(job->allCurStates + job->offset, job->curStateList,
+           sizeof(int) * job->count);
+    memcpy(job->allInputs + job->offset, job->inputList, job->count);
+    memcpy(job->allNextStates + job->offset, job->nextStateList,
+           sizeof(int) * job->count);
+    return NULL;
+}
+
+static uint64_t transitionKey(int curState, char input){
+    return ((uint64_t)(uint32_t)curState << 8) | (unsigned char)input;
+}
+
+static uint64_t hashKey(uint64_t key){
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+//third phase: find transitions whose state and input already appeared.
+//each job owns the keys that hash to its part and walks the whole
+//result in file order, so the earliest transition is always the one kept
+static void* loadCheckMain(void* arg){
+    LoadJob* job = arg;
+    int capacity = 64;
+    while (capacity < 2 * (job->length / job->parts + 1)){
+        capacity *= 2;
+    }
+    uint64_t* keys = malloc(sizeof(uint64_t) * capacity);
+    int* first = malloc(sizeof(int) * capacity);
+    memset(first, -1, sizeof(int) * capacity);
+    int used = 0;
+    int repeatCapacity = 0;
+    for (int i = 0; i < job->length; i++){
+        if (job->allInputs[i] == EPSILON){
+            continue;
+        }
+        uint64_t key = transitionKey(job->allCurStates[i], job->allInputs[i]);
+        uint64_t h = hashKey(key);
+        if ((int)(h % job->parts) != job->part){
+            continue;
+        }
+        int slot = (int)((h / job->parts) & (capacity - 1));
+        while (first[slot] >= 0 && keys[slot] != key){
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (first[slot] >= 0){
+            if (job->numRepeats == repeatCapacity){
+                repeatCapacity = repeatCapacity ? repeatCapacity * 2 : 64;
+                job->repeats = realloc(job->repeats,
+                                       sizeof(int) * 2 * repeatCapacity);
+            }
+            job->repeats[2 * job->numRepeats] = i;
+            job->repeats[2 * job->numRepeats + 1] = first[slot];
+            job->numRepeats++;
+            continue;
+        }
+        keys[slot] = key;
+        first[slot] = i;
+        //keep the table at most half full
+        if (++used * 2 > capacity){
+            int oldCapacity = capacity;
+            uint64_t* oldKeys = keys;
+            int* oldFirst = first;
+            capacity *= 2;
+            keys = malloc(sizeof(uint64_t) * capacity);
+            first = malloc(sizeof(int) * capacity);
+            memset(first, -1, sizeof(int) * capacity);
+            for (int k = 0; k < oldCapacity; k++){
+                if (oldFirst[k] >= 0){
+                    int s = (int)((hashKey(oldKeys[k]) / job->parts) & (capacity - 1));
+                    while (first[s] >= 0){
+                        s = (s + 1) & (capacity - 1);
+                    }
+                    keys[s] = oldKeys[k];
+                    first[s] = oldFirst[k];
+                }
+            }
+            free(oldKeys);
+            free(oldFirst);
+        }
+    }
+    free(keys);
+    free(first);
+    return NULL;
+}
+
+//sorts repeats by the later transition's position
+static int compareRepeat(const void* a, const void* b){
+    return ((const int*)a)[0] - ((const int*)b)[0];
+}
+
+//loads a definition file on several threads. the file is mapped and split
+//into one chunk per thread at whitespace; each thread parses its chunk
+//into its own arrays, then they are copied into the result in file
+//order. repeated transitions for a state and input are reported in file
+//order: exact repeats, and if reportConflicts, ones with another next
+//state (the first one is used, as in moveOne). returns the length
+int loadParallel(char* file, int jobs, int reportConflicts, int** curStateList,
+                 char** inputList, int** nextStateList){
+    int fd = open(file, O_RDONLY);
+    if (fd < 0){
+        printf("Error reading definition file\n");
+        exit(0);
+    }
+    printf("processing FSM definition file %s\n", file);
+    struct stat info;
+    fstat(fd, &info);
+    size_t size = info.st_size;
+    const char* data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (data == MAP_FAILED){
+        printf("Error reading definition file\n");
+        exit(0);
+    }
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+
+    LoadJob* job = calloc(jobs, sizeof(LoadJob));
+    const char* begin = data;
+    for (int j = 0; j < jobs; j++){
+        const char* end = (j == jobs - 1) ? data + size
+                                          : data + size * (j + 1) / jobs;
+        if (end < begin){
+            end = begin;
+        }
+        //don't split a token between two chunks
+        while (end < data + size && !isSeparator(*end)){
+            end++;
+        }
+        job[j].begin = begin;
+        job[j].end = end;
+        begin = end;
+        pthread_create(&job[j].thread, NULL, loadParseMain, &job[j]);
+    }
+    int length = 0;
+    int syntaxError = 0;
+    for (int j = 0; j < jobs; j++){
+        pthread_join(job[j].thread, NULL);
+        job[j].offset = length;
+        length += job[j].count;
+        syntaxError = syntaxError || job[j].syntaxError;
+    }
+    if (syntaxError){
+        printf("Error in syntax of definition file\n");
+        exit(0);
+    }
+    printf("FSM has %d transitions\n", length);
+
+    *curStateList = malloc(sizeof(int) * (length ? length : 1));
+    *inputList = malloc(length ? length : 1);
+    *nextStateList = malloc(sizeof(int) * (length ? length : 1));
+    for (int j = 0; j < jobs; j++){
+        job[j].length = length;
+        job[j].allCurStates = *curStateList;
+        job[j].allInputs = *inputList;
+        job[j].allNextStates = *nextStateList;
+        pthread_create(&job[j].thread, NULL, loadMergeMain, &job[j]);
+    }
+    for (int j = 0; j < jobs; j++){
+        pthread_join(job[j].thread, NULL);
+        free(job[j].curStateList);
+        free(job[j].inputList);
+        free(job[j].nextStateList);
+    }
+    if (size){
+        munmap((void*)data, size);
+    }
+
+    //check for repeats, then put them back in file order
+    for (int j = 0; j < jobs; j++){
+        job[j].part = j;
+        job[j].parts = jobs;
+        pthread_create(&job[j].thread, NULL, loadCheckMain, &job[j]);
+    }
+    int numRepeats = 0;
+    for (int j = 0; j < jobs; j++){
+        pthread_join(job[j].thread, NULL);
+        numRepeats += job[j].numRepeats;
+    }
+    int* repeats = malloc(sizeof(int) * 2 * (numRepeats ? numRepeats : 1));
+    numRepeats = 0;
+    for (int j = 0; j < jobs; j++){
+        if (job[j].numRepeats){
+            memcpy(repeats + 2 * numRepeats, job[j].repeats,
+                   sizeof(int) * 2 * job[j].numRepeats);
+        }
+        numRepeats += job[j].numRepeats;
+        free(job[j].repeats);
+    }
+    qsort(repeats, numRepeats, sizeof(int) * 2, compareRepeat);
+
+    int duplicates = 0, conflicts = 0, shown = 0;
+    for (int r = 0; r < numRepeats; r++){
+        int i = repeats[2 * r], first = repeats[2 * r + 1];
+        int conflict = (*nextStateList)[i] != (*nextStateList)[first];
+        if (conflict && !reportConflicts){
+            continue; //an NFA may have several next states
+        }
+        if (conflict){
+            conflicts++;
+        }
+        else{
+            duplicates++;
+        }
+        if (shown++ < 10){
+            printf("Warning: transition %d (state %d with input %c) %s "
+                   "transition %d\n", i, (*curStateList)[i], (*inputList)[i],
+                   conflict ? "conflicts with" : "repeats", first);
+        }
+    }
+    if (duplicates || conflicts){
+        printf("FSM has %d repeated and %d conflicting transitions, "
+               "the first of each is used\n", duplicates, conflicts);
+    }
+    free(repeats);
+    free(job);
+    return length;
+}
+
+//times loading a large generated definition with getLength and storeData,
+//then in parallel on 1 thread up to one per core
+void benchLoad(){
+    int numStates = 1 << 20, numInputs = 8;
+    int length = numStates * numInputs;
+    int* curStateList = malloc(sizeof(int) * length);
+    char* inputList = malloc(length);
+    int* nextStateList = malloc(sizeof(int) * length);
+    generateFSM(numStates, numInputs, 11, curStateList, inputList, nextStateList);
+
+    char file[] = "/tmp/fsmbenchXXXXXX";
+    int fd = mkstemp(file);
+    FILE* out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!out){
+        printf("Error writing benchmark definition file\n");
+        return;
+    }
+    for (int i = 0; i < length; i++){
+        fprintf(out, "%d:%c>%d\n", curStateList[i], inputList[i], nextStateList[i]);
+    }
+    fclose(out);
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+
+    //the loaders print their usual messages; keep them out of the results
+    fflush(stdout);
+    int savedStdout = dup(1);
+    int devNull = open("/dev/null", O_WRONLY);
+    double times[64];
+    int runs = 0;
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    dup2(devNull, 1);
+    double begin = seconds();
+    length = getLength(file);
+    curStateList = malloc(sizeof(int) * length);
+    inputList = malloc(length);
+    nextStateList = malloc(sizeof(int) * length);
+    storeData(length, file, curStateList, inputList, nextStateList);
+    fflush(stdout);
+    times[runs++] = seconds() - begin;
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+
+    for (int jobs = 1; jobs <= cores; jobs = nextThreadCount(jobs, cores)){
+        begin = seconds();
+        loadParallel(file, jobs, 1, &curStateList, &inputList, &nextStateList);
+        fflush(stdout);
+        times[runs++] = seconds() - begin;
+        free(curStateList);
+        free(inputList);
+        free(nextStateList);
+    }
+    dup2(savedStdout, 1);
+    close(savedStdout);
+    close(devNull);
+    unlink(file);
+
+    printf("load benchmark: %d transitions\n", length);
+    printf("storeData:  %7.3f s\n", times[0]);
+    runs = 1;
+    for (int jobs = 1; jobs <= cores; jobs = nextThreadCount(jobs, cores)){
+        printf("%3d jobs:   %7.3f s\n", jobs, times[runs++]);
+    }
+}
+
+//result of running one engine on a fuzz case
+typedef struct {
+    int state;       //state id the run finished in, or was in at the error
+    long long step;  //steps taken
+    int status;
+} FuzzResult;
+
+//prints a fuzz case in definition file syntax so it can be rerun
+static void printFuzzCase(int length, int* curStateList, char* inputList,
+                          int* nextStateList, const char* inputOrder, int length2){
+    printf("definition:\n");
+    for (int i = 0; i < length; i++){
+        printf("%d:%c>%d\n", curStateList[i], inputList[i], nextStateList[i]);
+    }
+    printf("inputs:\n");
+    for (int i = 0; i < length2; i++){
+        printf("%c\n", inputOrder[i]);
+    }
+}
+
+//compares an engine's result with moveOne's. prints the case if verbose
+static int fuzzCheck(const char* engine, FuzzResult expected, FuzzResult got,
+                     int verbose){
+    if (expected.state == got.state && expected.step == got.step
+        && expected.status == got.status){
+        return 1;
+    }
+    if (verbose){
+        printf("MISMATCH in %s: moveOne gives state %d, step %lld, status %d; "
+               "%s gives state %d, step %lld, status %d\n", engine,
+               expected.state, expected.step, expected.status, engine,
+               got.state, got.step, got.status);
+    }
+    return 0;
+}
+
+//generates random machines and inputs and checks that every engine gives
+//the same final state, error and error position as moveOne's linear scan.
+//machines have random state ids, missing transitions, repeated and
+//conflicting transitions and sometimes no state 0; inputs sometimes
+//include a char that isn't valid. stops at the first mismatch and
+//returns the number of failing cases
+int fuzzEngines(int cases, unsigned long long seed, int verbose){
+    seed = seed ? seed : 1;
+    for (int c = 0; c < cases; c++){
+        unsigned long long caseSeed = seed;
+        int numStates = 1 + (int)(rngNext(&seed) % 40);
+        int numInputs = 1 + (int)(rngNext(&seed) % 8);
+        int ids[40];
+        char alphabet[8];
+        for (int s = 0; s < numStates; s++){
+            ids[s] = (int)(rngNext(&seed) % 100000) - 1000;
+        }
+        if (rngNext(&seed) % 4){
+            ids[0] = 0; //usually the start state is in the machine
+        }
+        for (int k = 0; k < numInputs; k++){
+            int unique;
+            do{
+                alphabet[k] = (char)(33 + rngNext(&seed) % 94);
+                unique = 1;
+                for (int m = 0; m < k; m++){
+                    unique = unique && alphabet[m] != alphabet[k];
+                }
+            } while (!unique);
+        }
+
+        //most transitions exist, some are repeated or conflict
+        int capacity = numStates * numInputs * 2;
+        int* curStateList = malloc(sizeof(int) * capacity);
+        char* inputList = malloc(capacity);
+        int* nextStateList = malloc(sizeof(int) * capacity);
+        int length = 0;
+        for (int s = 0; s < numStates; s++){
+            for (int k = 0; k < numInputs; k++){
+                int copies = rngNext(&seed) % 5 ? 1 : (int)(rngNext(&seed) % 3);
+                for (int m = 0; m < copies; m++){
+                    curStateList[length] = ids[s];
+                    inputList[length] = alphabet[k];
+                    nextStateList[length] = ids[rngNext(&seed) % numStates];
+                    length++;
+                }
+            }
+        }
+        //shuffle, so first-match order is tested
+        for (int i = length - 1; i > 0; i--){
+            int j = (int)(rngNext(&seed) % (i + 1));
+            int tmpState = curStateList[i];
+            char tmpInput = inputList[i];
+            int tmpNext = nextStateList[i];
+            curStateList[i] = curStateList[j];
+            inputList[i] = inputList[j];
+            nextStateList[i] = nextStateList[j];
+            curStateList[j] = tmpState;
+            inputList[j] = tmpInput;
+            nextStateList[j] = tmpNext;
+        }
+        int length2 = (int)(rngNext(&seed) % 300);
+        char* inputOrder = malloc(length2 + 1);
+        for (int i = 0; i < length2; i++){
+            inputOrder[i] = rngNext(&seed) % 500
+                            ? alphabet[rngNext(&seed) % numInputs]
+                            : (char)(33 + rngNext(&seed) % 94);
+        }
+
+        //the reference: moveOne's scan, one step at a time from state 0
+        FuzzResult expected = {0, 0, RUN_OK};
+        while (expected.step < length2){
+            int status;
+            int next = scanStep(length, curStateList, inputList, nextStateList,
+                                inputOrder[expected.step], expected.state, &status);
+            if (status != RUN_OK){
+                expected.status = status;
+                break;
+            }
+            expected.state = next;
+            expected.step++;
+        }
+
+        //does the machine have a state and input with 2 different next
+        //states? then the NFA engines are expected to differ
+        int nondeterministic = 0;
+        for (int i = 0; i < length && !nondeterministic; i++){
+            for (int j = i + 1; j < length; j++){
+                if (curStateList[i] == curStateList[j] && inputList[i] == inputList[j]
+                    && nextStateList[i] != nextStateList[j]){
+                    nondeterministic = 1;
+                    break;
+                }
+            }
+        }
+
+        int ok = 1;
+        FuzzResult got;
+        FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+
+        //compiled table
+        int state = runTable(table, inputOrder, length2, table->start,
+                             &got.step, &got.status);
+        got.state = table->stateIds[state];
+        ok = ok && fuzzCheck("runTable", expected, got, verbose);
+
+        //compressed table
+        CombTable* comb = compressFSM(table);
+        state = runComb(comb, inputOrder, length2, comb->start, &got.step,
+                        &got.status);
+        got.state = comb->stateIds[state];
+        ok = ok && fuzzCheck("runComb", expected, got, verbose);
+        freeCombTable(comb);
+
+        //narrow table, in every width the machine fits in
+        for (int width = 0; width <= 4; width = width ? width * 2 : 1){
+            NarrowTable* narrow = narrowFSM(table, width);
+            state = runNarrow(narrow, inputOrder, length2, narrow->start,
+                              &got.step, &got.status);
+            got.state = narrow->stateIds[state];
+            ok = ok && fuzzCheck("runNarrow", expected, got, verbose);
+            freeNarrowTable(narrow);
+        }
+
+        //transducer with no outputs, parsed from the case in definition
+        //file syntax, writing to /dev/null
+        char* text = NULL;
+        size_t textSize = 0;
+        FILE* textFile = open_memstream(&text, &textSize);
+        for (int i = 0; i < length; i++){
+            fprintf(textFile, "%d:%c>%d\n", curStateList[i], inputList[i],
+                    nextStateList[i]);
+        }
+        fclose(textFile);
+        Transducer* transducer = parseTransducer(text, textSize);
+        free(text);
+        if (transducer){
+            OutputBuffer out;
+            outputInit(&out, open("/dev/null", O_WRONLY));
+            state = runTransducer(transducer, inputOrder, length2, &out,
+                                  &got.step, &got.status);
+            outputFlush(&out);
+            got.state = transducer->table->stateIds[state];
+            ok = ok && fuzzCheck("runTransducer", expected, got, verbose)
+                 && out.bytes == 0;
+            close(out.fd);
+            free(out.staging);
+            freeTransducer(transducer);
+        }
+        else{
+            ok = ok && fuzzCheck("parseTransducer", expected,
+                                 (FuzzResult){INT32_MIN, -1, -1}, verbose);
+        }
+
+        //streamed through a pipe, one input per line like an inputs file
+        int pipeFds[2];
+        if (pipe(pipeFds) == 0){
+            char* lines = malloc(2 * length2 + 1);
+            for (int i = 0; i < length2; i++){
+                lines[2 * i] = inputOrder[i];
+                lines[2 * i + 1] = '\n';
+            }
+            //at most 600 bytes, which fits in the pipe without a reader
+            int wrote = write(pipeFds[1], lines, 2 * length2) == 2 * length2;
+            ok = ok && wrote;
+            close(pipeFds[1]);
+            free(lines);
+            InputStream* stream = streamOpenFd(pipeFds[0]);
+            char badInput;
+            state = runStream(table, stream, &got.step, &got.status, &badInput);
+            streamClose(stream);
+            got.state = table->stateIds[state];
+            ok = ok && fuzzCheck("runStream", expected, got, verbose);
+        }
+
+        //traced into a file in memory, then replayed to the last step
+        char traceFile[64];
+        int traceFd = memoryFile(traceFile, sizeof(traceFile));
+        if (traceFd >= 0){
+            TraceWriter* writer = traceCreate(traceFile,
+                                              table->stateIds[table->start]);
+            long long tracedStep;
+            int tracedStatus;
+            runTraced(table, inputOrder, length2, writer, &tracedStep, &tracedStatus);
+            traceClose(writer, tracedStatus,
+                       tracedStep < length2 ? inputOrder[tracedStep] : 0);
+            TraceReader reader;
+            got = (FuzzResult){INT32_MIN, -1, -1};
+            if (traceOpen(&reader, traceFile)){
+                TraceCursor cursor;
+                traceSeek(&reader, &cursor, reader.footer->steps);
+                got.state = cursor.state;
+                got.step = (long long)reader.footer->steps;
+                got.status = reader.footer->status;
+                traceCloseReader(&reader);
+            }
+            ok = ok && fuzzCheck("runTraced and replay", expected, got, verbose);
+            close(traceFd);
+        }
+
+        //real-time steps, one event at a time
+        RealtimeRun run;
+        realtimeInit(&run, table, 0);
+        for (int i = 0; i < length2; i++){
+            realtimeStep(&run, inputOrder[i]);
+        }
+        got.state = table->stateIds[run.state];
+        got.step = run.steps;
+        got.status = run.status;
+        ok = ok && fuzzCheck("realtimeStep", expected, got, verbose);
+        realtimeFree(&run);
+
+        //summary from every start, checked at the start state and at one
+        //other state against runTable from there
+        InputSummary* summary = summarizeInputs(table, inputOrder, length2);
+        state = summaryLookup(summary, table->start, &got.step, &got.status);
+        got.state = table->stateIds[state];
+        ok = ok && fuzzCheck("summarizeInputs", expected, got, verbose);
+        int other = (int)(rngNext(&seed) % table->numStates);
+        FuzzResult direct;
+        state = runTable(table, inputOrder, length2, other, &direct.step,
+                         &direct.status);
+        direct.state = table->stateIds[state];
+        state = summaryLookup(summary, other, &got.step, &got.status);
+        got.state = table->stateIds[state];
+        ok = ok && fuzzCheck("summarizeInputs from another state", direct, got,
+                             verbose);
+        freeSummary(summary);
+
+        //renumbered table, profiled on half the inputs
+        int* order = profileLayout(table, inputOrder, length2 / 2);
+        FSMTable* permuted = permuteFSM(table, order);
+        state = runTable(permuted, inputOrder, length2, permuted->start,
+                         &got.step, &got.status);
+        got.state = permuted->stateIds[state];
+        ok = ok && fuzzCheck("permuteFSM", expected, got, verbose);
+        freeFSMTable(permuted);
+        free(order);
+
+        //debugger's run to breakpoint, with a breakpoint that never fires
+        char* stateBreak = calloc(table->numStates + 1, 1);
+        char inputBreak[256] = {0};
+        int step = 0;
+        state = table->start;
+        runToBreak(table, inputOrder, length2, &state, &step, length2,
+                   stateBreak, inputBreak, &got.status);
+        got.state = table->stateIds[state];
+        got.step = step;
+        ok = ok && fuzzCheck("runToBreak", expected, got, verbose);
+        free(stateBreak);
+
+        //NFA and lazy DFA, which only match moveOne on deterministic machines
+        if (!nondeterministic){
+            NFATable* nfa = compileNFA(length, curStateList, inputList,
+                                       nextStateList);
+            uint64_t* set = malloc(sizeof(uint64_t) * nfa->words);
+            memcpy(set, nfa->startSet, sizeof(uint64_t) * nfa->words);
+            int count = runNFA(nfa, inputOrder, length2, set, &got.step,
+                               &got.status);
+            got.state = count == 1 ? nfa->stateIds[0] : INT32_MIN;
+            for (int s = 0; s < nfa->numStates; s++){
+                if (set[s / 64] & (1ULL << (s % 64))){
+                    got.state = count == 1 ? nfa->stateIds[s] : INT32_MIN;
+                }
+            }
+            ok = ok && fuzzCheck("runNFA", expected, got, verbose);
+
+            LazyDFA dfa;
+            lazyDFAInit(&dfa, nfa, rngNext(&seed) % 2 ? 1 : 1 << 20);
+            state = runLazyDFA(&dfa, inputOrder, length2, lazyDFAStart(&dfa),
+                               &got.step, &got.status);
+            got.state = INT32_MIN;
+            for (int s = 0; s < nfa->numStates; s++){
+                if (dfa.sets[(size_t)state * nfa->words + s / 64] & (1ULL << (s % 64))){
+                    got.state = nfa->stateIds[s];
+                }
+            }
+            ok = ok && fuzzCheck("runLazyDFA", expected, got, verbose);
+            lazyDFAFree(&dfa);
+            free(set);
+            freeNFATable(nfa);
+        }
+
+        //sessions engine, for a few cases since it starts threads
+        if (c % 16 == 0){
+            SessionEngine* engine = sessionEngineCreate(table, 1, 1);
+            sessionEngineStart(engine);
+            for (int i = 0; i < length2; i++){
+                sessionEnginePost(engine, 0, inputOrder[i]);
+            }
+            sessionEngineFinish(engine);
+            const SessionSlot* slot = sessionEngineSlot(engine, 0);
+            got.status = slot->status;
+            got.step = slot->steps;
+            got.state = slot->status == RUN_OK ? table->stateIds[slot->state]
+                                               : slot->stateId;
+            ok = ok && fuzzCheck("sessions", expected, got, verbose);
+            sessionEngineFree(engine);
+        }
+        freeFSMTable(table);
+
+        if (!ok && verbose){
+            printf("case %d (--seed=%llu --fuzz=1):\n", c, caseSeed);
+            printFuzzCase(length, curStateList, inputList, nextStateList,
+                          inputOrder, length2);
+        }
+        free(curStateList);
+        free(inputList);
+        free(nextStateList);
+        free(inputOrder);
+        if (!ok){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//decodes an output written in a definition file into out, which has room
+//for end - p bytes. returns the decoded length
+static size_t decodeOutput(const char* p, const char* end, char* out){
+    size_t size = 0;
+    while (p < end){
+        char c = *p++;
+        if (c == '\\' && p < end){
+            c = *p++;
+            c = c == 'n' ? '\n' : c == 't' ? '\t' : c == 's' ? ' ' : c;
+        }
+        out[size++] = c;
+    }
+    return size;
+}
+
+//skips an optionally signed number
+static const char* skipNumber(const char* p, const char* end){
+    if (p < end && (*p == '-' || *p == '+')){
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9'){
+        p++;
+    }
+    return p;
+}
+
+//parses a transducer definition held in memory: state:input>next/output
+//and state:input>next lines, and state/output lines. returns NULL if a
+//line isn't valid syntax
+Transducer* parseTransducer(const char* data, size_t size){
+    const char* end = data + size;
+    int capacity = 1024, length = 0;
+    int* curStateList = malloc(sizeof(int) * capacity);
+    char* inputList = malloc(capacity);
+    int* nextStateList = malloc(sizeof(int) * capacity);
+    const char** outBegin = malloc(sizeof(char*) * capacity);
+    const char** outEnd = malloc(sizeof(char*) * capacity);
+    IntMap stateOutput; //state id -> index of its state/output line
+    intMapInit(&stateOutput, 16);
+    int numStateLines = 0, stateLineCapacity = 16;
+    const char** stateBegin = malloc(sizeof(char*) * stateLineCapacity);
+    const char** stateEnd = malloc(sizeof(char*) * stateLineCapacity);
+    int ok = 1;
+
+    const char* p = data;
+    while (ok){
+        while (p < end && isSeparator(*p)){
+            p++;
+        }
+        if (p == end){
+            break;
+        }
+        const char* token = p;
+        while (p < end && !isSeparator(*p)){
+            p++;
+        }
+        if (length == capacity){
+            capacity *= 2;
+            curStateList = realloc(curStateList, sizeof(int) * capacity);
+            inputList = realloc(inputList, capacity);
+            nextStateList = realloc(nextStateList, sizeof(int) * capacity);
+            outBegin = realloc(outBegin, sizeof(char*) * capacity);
+            outEnd = realloc(outEnd, sizeof(char*) * capacity);
+        }
+
+        //state:input>next, with an optional /output after it
+        if (parseTransition(token, p, &curStateList[length], &inputList[length],
+                            &nextStateList[length]) && inputList[length] != EPSILON){
+            const char* rest = skipNumber(token, p) + 3;
+            rest = skipNumber(rest, p);
+            if (rest < p && *rest != '/'){
+                ok = 0;
+            }
+            outBegin[length] = rest < p ? rest + 1 : p;
+            outEnd[length] = p;
+            length++;
+            continue;
+        }
+
+        //state/output
+        const char* slash = skipNumber(token, p);
+        if (slash > token && slash < p && *slash == '/'){
+            if (numStateLines == stateLineCapacity){
+                stateLineCapacity *= 2;
+                stateBegin = realloc(stateBegin, sizeof(char*) * stateLineCapacity);
+                stateEnd = realloc(stateEnd, sizeof(char*) * stateLineCapacity);
+            }
+            stateBegin[numStateLines] = slash + 1;
+            stateEnd[numStateLines] = p;
+            //like transitions, the first output given for a state wins
+            if (intMapGet(&stateOutput, atoi(token)) < 0){
+                intMapPut(&stateOutput, atoi(token), numStateLines);
+            }
+            numStateLines++;
+            continue;
+        }
+        ok = 0;
+    }
+
+    Transducer* transducer = NULL;
+    if (ok){
+        transducer = calloc(1, sizeof(Transducer));
+        FSMTable* table = transducer->table = compileFSM(length, curStateList,
+                                                         inputList, nextStateList);
+        size_t cells = (size_t)(table->numStates + 1) * table->numClasses;
+        transducer->outputs = calloc(cells ? cells : 1, sizeof(OutputRef));
+        char* used = calloc(cells ? cells : 1, 1);
+        //decoded outputs are never longer than the text they come from, but
+        //a state's output is copied into every transition that enters it
+        size_t poolCapacity = size + 1;
+        transducer->pool = malloc(poolCapacity);
+
+        //the start state's own output is written before any input
+        int start = intMapGet(&stateOutput, 0);
+        if (start >= 0){
+            transducer->startOutput.offset = 0;
+            transducer->startOutput.length = (uint32_t)decodeOutput(
+                    stateBegin[start], stateEnd[start], transducer->pool);
+            transducer->poolSize = transducer->startOutput.length;
+        }
+
+        //the first transition for a cell is the one compileFSM used
+        IntMap ids;
+        intMapInit(&ids, table->numStates);
+        for (int i = 0; i < table->numStates; i++){
+            intMapPut(&ids, table->stateIds[i], i);
+        }
+        for (int i = 0; i < length; i++){
+            size_t cell = (size_t)intMapGet(&ids, curStateList[i]) * table->numClasses
+                          + table->classOf[(unsigned char)inputList[i]];
+            if (used[cell]){
+                continue;
+            }
+            used[cell] = 1;
+            int entered = intMapGet(&stateOutput, nextStateList[i]);
+            size_t most = (outEnd[i] - outBegin[i])
+                          + (entered >= 0 ? stateEnd[entered] - stateBegin[entered] : 0);
+            if (transducer->poolSize + most > poolCapacity){
+                poolCapacity = 2 * poolCapacity + most;
+                transducer->pool = realloc(transducer->pool, poolCapacity);
+            }
+            OutputRef* ref = &transducer->outputs[cell];
+            ref->offset = (uint32_t)transducer->poolSize;
+            ref->length = (uint32_t)decodeOutput(outBegin[i], outEnd[i],
+                                                 transducer->pool
+                                                 + transducer->poolSize);
+            if (entered >= 0){
+                ref->length += (uint32_t)decodeOutput(
+                        stateBegin[entered], stateEnd[entered],
+                        transducer->pool + transducer->poolSize + ref->length);
+            }
+            transducer->poolSize += ref->length;
+        }
+        intMapFree(&ids);
+        free(used);
+    }
+
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+    free(outBegin);
+    free(outEnd);
+    free(stateBegin);
+    free(stateEnd);
+    intMapFree(&stateOutput);
+    return transducer;
+}
+
+//reads a transducer definition file
+Transducer* loadTransducer(char* file){
+    int fd = open(file, O_RDONLY);
+    if (fd < 0){
+        printf("Error reading definition file\n");
+        exit(0);
+    }
+    printf("processing FSM definition file %s\n", file);
+    struct stat info;
+    fstat(fd, &info);
+    char* data = malloc(info.st_size ? info.st_size : 1);
+    size_t size = 0;
+    ssize_t got;
+    while (size < (size_t)info.st_size
+           && (got = read(fd, data + size, info.st_size - size)) > 0){
+        size += got;
+    }
+    close(fd);
+    Transducer* transducer = parseTransducer(data, size);
+    free(data);
+    if (!transducer){
+        printf("Error in syntax of definition file\n");
+        exit(0);
+    }
+    printf("FSM has %d states and %zu bytes of outputs\n",
+           transducer->table->numStates, transducer->poolSize);
+    return transducer;
+}
+
+void freeTransducer(Transducer* transducer){
+    freeFSMTable(transducer->table);
+    free(transducer->outputs);
+    free(transducer->pool);
+    free(transducer);
+}
+
+void outputInit(OutputBuffer* out, int fd){
+    memset(out, 0, sizeof(OutputBuffer));
+    out->fd = fd;
+    out->staging = malloc(OUTPUT_STAGING);
+}
+
+//turns the staging bytes written since the last iovec into one
+static void outputCloseSegment(OutputBuffer* out){
+    if (out->used > out->segmentStart){
+        out->iov[out->count].iov_base = out->staging + out->segmentStart;
+        out->iov[out->count].iov_len = out->used - out->segmentStart;
+        out->count++;
+        out->segmentStart = out->used;
+    }
+}
+
+//writes everything collected so far, in order, with writev
+void outputFlush(OutputBuffer* out){
+    outputCloseSegment(out);
+    struct iovec* iov = out->iov;
+    int count = out->count;
+    //after a failed write the rest of the output is dropped, and error
+    //says why
+    while (count > 0 && !out->error){
+        ssize_t wrote = writev(out->fd, iov, count);
+        if (wrote < 0 && errno == EINTR){
+            continue;
+        }
+        if (wrote < 0){
+            out->error = errno;
+            break;
+        }
+        out->bytes += wrote;
+        //skip what was written, which may end partway through an iovec
+        while (count > 0 && (size_t)wrote >= iov->iov_len){
+            wrote -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0){
+            iov->iov_base = (char*)iov->iov_base + wrote;
+            iov->iov_len -= wrote;
+        }
+    }
+    out->count = 0;
+    out->used = 0;
+    out->segmentStart = 0;
+}
+
+//adds an output. data must stay valid until the next flush
+void outputWrite(OutputBuffer* out, const char* data, size_t size){
+    if (size < OUTPUT_COPY_LIMIT){
+        if (out->used + size > OUTPUT_STAGING){
+            outputFlush(out);
+        }
+        memcpy(out->staging + out->used, data, size);
+        out->used += size;
+        return;
+    }
+    //leave room for the staging segment before this iovec, this iovec,
+    //and the staging segment after it, which outputFlush closes
+    if (out->count + 3 > OUTPUT_IOVECS){
+        outputFlush(out);
+    }
+    outputCloseSegment(out);
+    out->iov[out->count].iov_base = (void*)data;
+    out->iov[out->count].iov_len = size;
+    out->count++;
+}
+
+//like runTable, writing each transition's output
+int runTransducer(const Transducer* transducer, const char* inputOrder,
+                  long long length2, OutputBuffer* out, long long* step,
+                  int* status){
+    const FSMTable* table = transducer->table;
+    int curState = table->start;
+    long long i;
+    *status = RUN_OK;
+    if (transducer->startOutput.length){
+        outputWrite(out, transducer->pool, transducer->startOutput.length);
+    }
+    for (i = 0; i < length2; i++){
+        int cls = table->classOf[(unsigned char)inputOrder[i]];
+        if (cls < 0){
+            *status = RUN_INVALID_INPUT;
+            break;
+        }
+        size_t cell = (size_t)curState * table->numClasses + cls;
+        int nextState = table->next[cell];
+        if (nextState == table->dead){
+            *status = RUN_DEAD_END;
+            break;
+        }
+        const OutputRef* ref = &transducer->outputs[cell];
+        if (ref->length){
+            outputWrite(out, transducer->pool + ref->offset, ref->length);
+        }
+        curState = nextState;
+    }
+    *step = i;
+    return curState;
+}
+
+//compares one printf per step with the output buffer, for a tagger that
+//writes a short tag on most transitions, writing to /dev/null
+void benchEmit(){
+    int numStates = 64, numInputs = 16;
+    long long events = 20000000;
+    char* text = malloc((size_t)numStates * numInputs * 32);
+    size_t size = 0;
+    unsigned long long seed = 21;
+    for (int s = 0; s < numStates; s++){
+        for (int k = 0; k < numInputs; k++){
+            size += sprintf(text + size, "%d:%c>%d", s, 'a' + k,
+                            (int)(rngNext(&seed) % numStates));
+            if (rngNext(&seed) % 4){
+                size += sprintf(text + size, "/t%d\\n", (int)(rngNext(&seed) % 100));
+            }
+            text[size++] = '\n';
+        }
+    }
+    Transducer* transducer = parseTransducer(text, size);
+    free(text);
+    char* inputs = malloc(events);
+    for (long long k = 0; k < events; k++){
+        inputs[k] = (char)('a' + rngNext(&seed) % numInputs);
+    }
+    printf("emit benchmark: %d states, %lld events\n", numStates, events);
+
+    //one printf per step, the way the simulator prints its trace
+    FILE* devNull = fopen("/dev/null", "w");
+    const FSMTable* table = transducer->table;
+    int state = table->start;
+    double begin = seconds();
+    for (long long k = 0; k < events; k++){
+        size_t cell = (size_t)state * table->numClasses
+                      + table->classOf[(unsigned char)inputs[k]];
+        const OutputRef* ref = &transducer->outputs[cell];
+        if (ref->length){
+            fprintf(devNull, "%.*s", (int)ref->length, transducer->pool + ref->offset);
+        }
+        state = table->next[cell];
+    }
+    fflush(devNull);
+    double printed = seconds() - begin;
+    fclose(devNull);
+
+    OutputBuffer out;
+    outputInit(&out, open("/dev/null", O_WRONLY));
+    long long step;
+    int status;
+    begin = seconds();
+    runTransducer(transducer, inputs, events, &out, &step, &status);
+    outputFlush(&out);
+    double buffered = seconds() - begin;
+    close(out.fd);
+    free(out.staging);
+
+    printf("printf per step: %8.1f M steps/s\n", events / printed / 1e6);
+    printf("output buffer:   %8.1f M steps/s, %.1f MB/s\n", events / buffered / 1e6,
+           out.bytes / buffered / 1e6);
+    free(inputs);
+    freeTransducer(transducer);
+}
+
+//FNV-1a, continuing from hash. start with FNV_OFFSET
+uint64_t fnvHash(uint64_t hash, const void* data, size_t size){
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++){
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+//hash of everything a run depends on, so cached summaries are only used
+//for the same compiled table
+uint64_t hashTable(const FSMTable* table){
+    uint64_t hash = fnvHash(FNV_OFFSET, &table->numStates, sizeof(int));
+    hash = fnvHash(hash, &table->numClasses, sizeof(int));
+    hash = fnvHash(hash, table->stateIds, sizeof(int) * table->numStates);
+    hash = fnvHash(hash, table->classOf, sizeof(table->classOf));
+    return fnvHash(hash, table->next, sizeof(int) * (size_t)(table->numStates + 1)
+                                      * table->numClasses);
+}
+
+//runs the inputs from every state at once. image holds the distinct states
+//the runs are in, and each start state points to its slot in image, so
+//runs that reach the same state are stepped once from then on. every
+//SUMMARY_MERGE steps the slots are merged, and slots that hit the dead
+//state are replayed from the last merge to find the step they stopped at
+InputSummary* summarizeInputs(const FSMTable* table, const char* inputOrder,
+                              long long length2){
+    int n = table->numStates;
+    int numClasses = table->numClasses;
+    InputSummary* summary = malloc(sizeof(InputSummary));
+    summary->numStates = n;
+    summary->length = length2;
+    summary->finalState = malloc(sizeof(int32_t) * (n ? n : 1));
+    summary->steps = malloc(sizeof(int64_t) * (n ? n : 1));
+    summary->status = malloc(n ? n : 1);
+
+    int* image = malloc(sizeof(int) * (n ? n : 1));
+    int* checkpoint = malloc(sizeof(int) * (n ? n : 1)); //image at last merge
+    int* owner = malloc(sizeof(int) * (n ? n : 1));     //slot, or ~start that stopped
+    int* first = malloc(sizeof(int) * (n ? n : 1));     //first start using each slot
+    int* remap = malloc(sizeof(int) * (n ? n : 1));
+    int* slotOf = malloc(sizeof(int) * (n + 1));
+    for (int s = 0; s < n; s++){
+        image[s] = checkpoint[s] = owner[s] = first[s] = s;
+        slotOf[s] = -1;
+    }
+    slotOf[n] = -1;
+    int count = n;
+    long long merged = 0; //step of the last merge
+    long long i = 0;
+    int stopStatus = RUN_OK;
+
+    for (;;){
+        //step every slot until the next merge, an invalid input or the end
+        long long stop = merged + SUMMARY_MERGE < length2 ? merged + SUMMARY_MERGE
+                                                         : length2;
+        for (; i < stop; i++){
+            int cls = table->classOf[(unsigned char)inputOrder[i]];
+            if (cls < 0){
+                stopStatus = RUN_INVALID_INPUT;
+                break;
+            }
+            const int* column = table->next + cls;
+            for (int j = 0; j < count; j++){
+                image[j] = column[(size_t)image[j] * numClasses];
+            }
+        }
+
+        //merge slots in the same state. a slot in the dead state stopped
+        //since the last merge, so it is replayed from there
+        int kept = 0;
+        for (int j = 0; j < count; j++){
+            if (image[j] == table->dead){
+                long long step;
+                int status;
+                int last = runTable(table, inputOrder + merged, i - merged,
+                                    checkpoint[j], &step, &status);
+                summary->finalState[first[j]] = last;
+                summary->steps[first[j]] = merged + step;
+                summary->status[first[j]] = RUN_DEAD_END;
+                remap[j] = ~first[j];
+            }
+            else if (slotOf[image[j]] >= 0){
+                remap[j] = slotOf[image[j]];
+            }
+            else{
+                slotOf[image[j]] = kept;
+                image[kept] = checkpoint[kept] = image[j];
+                first[kept] = first[j];
+                remap[j] = kept++;
+            }
+        }
+        for (int s = 0; s < n; s++){
+            owner[s] = owner[s] >= 0 ? remap[owner[s]] : owner[s];
+        }
+        for (int j = 0; j < kept; j++){
+            slotOf[image[j]] = -1;
+        }
+        count = kept;
+        merged = i;
+        if (i == length2 || stopStatus != RUN_OK || count == 0){
+            break;
+        }
+    }
+
+    //runs still going end here; runs that stopped copy the start that
+    //stood for them
+    for (int s = 0; s < n; s++){
+        if (owner[s] >= 0){
+            summary->finalState[s] = image[owner[s]];
+            summary->steps[s] = i;
+            summary->status[s] = stopStatus;
+        }
+        else if (~owner[s] != s){
+            summary->finalState[s] = summary->finalState[~owner[s]];
+            summary->steps[s] = summary->steps[~owner[s]];
+            summary->status[s] = summary->status[~owner[s]];
+        }
+    }
+    free(image);
+    free(checkpoint);
+    free(owner);
+    free(first);
+    free(remap);
+    free(slotOf);
+    return summary;
+}
+
+//the result of the summarized inputs from a dense start state
+int summaryLookup(const InputSummary* summary, int startState, long long* step,
+                  int* status){
+    *step = summary->steps[startState];
+    *status = summary->status[startState];
+    return summary->finalState[startState];
+}
+
+void freeSummary(InputSummary* summary){
+    free(summary->finalState);
+    free(summary->steps);
+    free(summary->status);
+    free(summary);
+}
+
+//reads a cached summary. returns NULL if the file is missing, damaged or
+//was made for other inputs or another table
+InputSummary* readSummary(const char* file, uint64_t tableHash, uint64_t inputHash){
+    FILE* in = fopen(file, "rb");
+    if (!in){
+        return NULL;
+    }
+    SummaryHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1
+        || memcmp(header.magic, SUMMARY_MAGIC, 8) || header.tableHash != tableHash
+        || header.inputHash != inputHash || header.numStates <= 0){
+        fclose(in);
+        return NULL;
+    }
+    int n = header.numStates;
+    InputSummary* summary = malloc(sizeof(InputSummary));
+    summary->numStates = n;
+    summary->length = header.length;
+    summary->finalState = malloc(sizeof(int32_t) * n);
+    summary->steps = malloc(sizeof(int64_t) * n);
+    summary->status = malloc(n);
+    int ok = fread(summary->finalState, sizeof(int32_t), n, in) == (size_t)n
+             && fread(summary->steps, sizeof(int64_t), n, in) == (size_t)n
+             && fread(summary->status, 1, n, in) == (size_t)n;
+    fclose(in);
+    if (!ok){
+        freeSummary(summary);
+        return NULL;
+    }
+    return summary;
+}
+
+//saves a summary for readSummary
+void writeSummary(const InputSummary* summary, const char* file,
+                  uint64_t tableHash, uint64_t inputHash){
+    FILE* out = fopen(file, "wb");
+    if (!out){
+        printf("Error writing summary file %s\n", file);
+        return;
+    }
+    SummaryHeader header = {SUMMARY_MAGIC, tableHash, inputHash, summary->length,
+                            summary->numStates, 0};
+    int n = summary->numStates;
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(summary->finalState, sizeof(int32_t), n, out);
+    fwrite(summary->steps, sizeof(int64_t), n, out);
+    fwrite(summary->status, 1, n, out);
+    fclose(out);
+}
+
+//--all-starts and --start=S: summarizes the inputs, or loads the summary
+//from the cache, then prints the result from every state or from S
+void runSummarized(const Options* options, FSMTable* table, char* inputOrder,
+                   int length2){
+    uint64_t tableHash = hashTable(table);
+    uint64_t inputHash = fnvHash(FNV_OFFSET, inputOrder, length2);
+    char file[4096] = "";
+    InputSummary* summary = NULL;
+    if (options->summaryCache){
+        snprintf(file, sizeof(file), "%s/%016llx.fsmsum", options->summaryCache,
+                 (unsigned long long)inputHash);
+        summary = readSummary(file, tableHash, inputHash);
+        if (summary){
+            printf("using cached summary %s\n", file);
+        }
+    }
+    if (!summary){
+        summary = summarizeInputs(table, inputOrder, length2);
+        if (options->summaryCache){
+            writeSummary(summary, file, tableHash, inputHash);
+        }
+    }
+
+    long long step;
+    int status;
+    if (options->hasStart){
+        int start = -1;
+        for (int s = 0; s < table->numStates && start < 0; s++){
+            start = table->stateIds[s] == options->start ? s : -1;
+        }
+        if (start < 0){
+            printf("Error: state %d is not in the definition\n", options->start);
+        }
+        else{
+            int curState = summaryLookup(summary, start, &step, &status);
+            printRunResult(table, curState, step, status,
+                           step < length2 ? inputOrder[step] : 0);
+        }
+    }
+    if (options->allStarts){
+        for (int s = 0; s < table->numStates; s++){
+            int curState = summaryLookup(summary, s, &step, &status);
+            printf("from state %d: ", table->stateIds[s]);
+            printRunResult(table, curState, step, status,
+                           step < length2 ? inputOrder[step] : 0);
+        }
+    }
+    freeSummary(summary);
+}
+
+//compares one runTable per start state with one summarizeInputs pass, on
+//a random machine (where runs soon reach the same states) and on one where
+//every input permutes the states, so runs never meet
+void benchSummary(){
+    int numStates = 1024, numInputs = 16;
+    long long events = 1000000;
+    int length = numStates * numInputs;
+    int* curStateList = malloc(sizeof(int) * length);
+    char* inputList = malloc(length);
+    int* nextStateList = malloc(sizeof(int) * length);
+    char* inputs = malloc(events);
+    unsigned long long seed = 17;
+    for (long long k = 0; k < events; k++){
+        inputs[k] = (char)('a' + rngNext(&seed) % numInputs);
+    }
+    printf("summary benchmark: %d states, %lld events\n", numStates, events);
+
+    for (int permutation = 0; permutation < 2; permutation++){
+        generateFSM(numStates, numInputs, 13, curStateList, inputList, nextStateList);
+        if (permutation){
+            for (int i = 0; i < length; i++){
+                nextStateList[i] = (curStateList[i] + inputList[i] - 'a' + 1) % numStates;
+            }
+        }
+        FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+        double begin = seconds();
+        long long step;
+        int status;
+        long long check = 0;
+        for (int s = 0; s < numStates; s++){
+            check += runTable(table, inputs, events, s, &step, &status);
+        }
+        double separate = seconds() - begin;
+        begin = seconds();
+        InputSummary* summary = summarizeInputs(table, inputs, events);
+        double together = seconds() - begin;
+        for (int s = 0; s < numStates; s++){
+            check -= summaryLookup(summary, s, &step, &status);
+        }
+        printf("%s machine: one run per state %8.3f s, summary %8.3f s%s\n",
+               permutation ? "permutation" : "random     ", separate, together,
+               check ? " (MISMATCH)" : "");
+        freeSummary(summary);
+        freeFSMTable(table);
+    }
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+    free(inputs);
+}
+
+//bytes per entry of the narrowest table that holds every dense state of
+//table, dead included
+int narrowWidth(const FSMTable* table){
+    int rows = table->numStates + 1;
+    return rows <= 1 << 8 ? 1 : rows <= 1 << 16 ? 2 : 4;
+}
+
+//makes a copy of a table with next states width bytes wide, or as narrow
+//as possible if width is 0. every dense state, dead included, must fit
+NarrowTable* narrowFSM(const FSMTable* table, int width){
+    NarrowTable* narrow = calloc(1, sizeof(NarrowTable));
+    int rows = table->numStates + 1;
+    if (!width){
+        width = narrowWidth(table);
+    }
+    narrow->numStates = table->numStates;
+    narrow->numClasses = table->numClasses;
+    narrow->dead = table->dead;
+    narrow->start = table->start;
+    narrow->width = width;
+    narrow->stateIds = malloc(sizeof(int) * (table->numStates ? table->numStates : 1));
+    memcpy(narrow->stateIds, table->stateIds, sizeof(int) * table->numStates);
+    memcpy(narrow->classOf, table->classOf, sizeof(narrow->classOf));
+    memcpy(narrow->classChar, table->classChar, sizeof(narrow->classChar));
+    size_t cells = (size_t)rows * table->numClasses;
+    narrow->next = malloc(width * (cells ? cells : 1));
+    for (size_t i = 0; i < cells; i++){
+        if (width == 1){
+            ((uint8_t*)narrow->next)[i] = (uint8_t)table->next[i];
+        }
+        else if (width == 2){
+            ((uint16_t*)narrow->next)[i] = (uint16_t)table->next[i];
+        }
+        else{
+            ((uint32_t*)narrow->next)[i] = (uint32_t)table->next[i];
+        }
+    }
+    return narrow;
+}
+
+void freeNarrowTable(NarrowTable* narrow){
+    free(narrow->stateIds);
+    free(narrow->next);
+    free(narrow);
+}
+
+//bytes used by the transitions of a narrow table
+size_t narrowBytes(const NarrowTable* narrow){
+    return (size_t)narrow->width * (narrow->numStates + 1) * narrow->numClasses;
+}
+
+//defines runTable for a narrow table with entries of type TYPE, so each
+//width gets its own loop with the entry size known to the compiler
+#define DEFINE_RUN_NARROW(NAME, TYPE)                                         \
+static int NAME(const NarrowTable* narrow, const char* inputOrder,            \
+                long long length2, int startState, long long* step,           \
+                int* status){                                                 \
+    const TYPE* next = narrow->next;                                          \
+    int curState = startState;                                                \
+    long long i;                                                              \
+    *status = RUN_OK;                                                         \
+    for (i = 0; i < length2; i++){                                            \
+        int cls = narrow->classOf[(unsigned char)inputOrder[i]];              \
+        if (cls < 0){                                                         \
+            *status = RUN_INVALID_INPUT;                                      \
+            break;                                                            \
+        }                                                                     \
+        int nextState = next[(size_t)curState * narrow->numClasses + cls];    \
+        if (nextState == narrow->dead){                                       \
+            *status = RUN_DEAD_END;                                           \
+            break;                                                            \
+        }                                                                     \
+        curState = nextState;                                                 \
+    }                                                                         \
+    *step = i;                                                                \
+    return curState;                                                          \
+}
+
+DEFINE_RUN_NARROW(runNarrow8, uint8_t)
+DEFINE_RUN_NARROW(runNarrow16, uint16_t)
+DEFINE_RUN_NARROW(runNarrow32, uint32_t)
+
+//like runTable, on a narrow table
+int runNarrow(const NarrowTable* narrow, const char* inputOrder, long long length2,
+              int startState, long long* step, int* status){
+    if (narrow->width == 1){
+        return runNarrow8(narrow, inputOrder, length2, startState, step, status);
+    }
+    if (narrow->width == 2){
+        return runNarrow16(narrow, inputOrder, length2, startState, step, status);
+    }
+    return runNarrow32(narrow, inputOrder, length2, startState, step, status);
+}
+
+//prints the bytes used by each structure for a definition of length
+//transitions and length2 inputs. table is NULL for engines that run on the
+//definition arrays, length is -1 when they aren't kept, and comb is only
+//given when the run compressed the table
+void printStats(int length, long long length2, const FSMTable* table,
+                const CombTable* comb){
+    printf("memory used:\n");
+    if (length >= 0){
+        printf("  definition arrays %12zu bytes (%d transitions)\n",
+               (sizeof(int) * 2 + 1) * (size_t)length, length);
+    }
+    printf("  inputs            %12zu bytes\n", (size_t)length2);
+    if (table){
+        int width = narrowWidth(table);
+        printf("  state ids         %12zu bytes (%d states)\n",
+               sizeof(int) * (size_t)table->numStates, table->numStates);
+        printf("  input classes     %12zu bytes (%d inputs)\n",
+               sizeof(table->classOf) + sizeof(table->classChar),
+               table->numClasses);
+        printf("  dense table       %12zu bytes (4 byte entries)\n",
+               tableBytes(table));
+        printf("  narrow table      %12zu bytes (%d byte entries)\n",
+               tableBytes(table) / sizeof(int) * width, width);
+    }
+    if (comb){
+        printf("  compressed table  %12zu bytes\n", combBytes(comb));
+    }
+}
+
+//compares 4 byte entries with the narrowest ones for machines whose dense
+//tables are around the sizes of the L1, L2 and last level caches
+void benchNarrow(){
+    const int sizes[] = {200, 4000, 60000};
+    int numInputs = 16;
+    long long events = 50000000;
+    char* inputs = malloc(events);
+    unsigned long long seed = 29;
+    for (long long k = 0; k < events; k++){
+        inputs[k] = (char)('a' + rngNext(&seed) % numInputs);
+    }
+    printf("narrow benchmark: %d inputs, %lld events\n", numInputs, events);
+    for (int n = 0; n < 3; n++){
+        int numStates = sizes[n];
+        int length = numStates * numInputs;
+        int* curStateList = malloc(sizeof(int) * length);
+        char* inputList = malloc(length);
+        int* nextStateList = malloc(sizeof(int) * length);
+        generateFSM(numStates, numInputs, 31, curStateList, inputList, nextStateList);
+        FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+        NarrowTable* narrow = narrowFSM(table, 0);
+        long long step;
+        int status;
+        double begin = seconds();
+        int wide = runTable(table, inputs, events, table->start, &step, &status);
+        double wideTime = seconds() - begin;
+        begin = seconds();
+        int narrowEnd = runNarrow(narrow, inputs, events, narrow->start, &step,
+                                  &status);
+        double narrowTime = seconds() - begin;
+        printf("%6d states: int %9zu bytes %6.2f ns/step, uint%d %9zu bytes "
+               "%6.2f ns/step%s\n", numStates, tableBytes(table),
+               wideTime / events * 1e9, narrow->width * 8, narrowBytes(narrow),
+               narrowTime / events * 1e9, wide == narrowEnd ? "" : " (MISMATCH)");
+        freeNarrowTable(narrow);
+        freeFSMTable(table);
+        free(curStateList);
+        free(inputList);
+        free(nextStateList);
+    }
+    free(inputs);
+}
+
+//regex parser state; nodes grow as patterns are parsed
+typedef struct {
+    RegexNode* nodes;
+    int count;
+    int capacity;
+    const char* p;
+    const char* error;  //set on the first syntax error
+} RegexParser;
+
+//part of an NFA: its end is a REGEX_EMPTY node whose out isn't set yet
+typedef struct {
+    int start;
+    int end;
+} RegexFragment;
+
+static RegexFragment regexAlternation(RegexParser* parser);
+
+static int regexNode(RegexParser* parser, int type){
+    if (parser->count == parser->capacity){
+        parser->capacity *= 2;
+        parser->nodes = realloc(parser->nodes, sizeof(RegexNode) * parser->capacity);
+    }
+    RegexNode* node = &parser->nodes[parser->count];
+    memset(node, 0, sizeof(RegexNode));
+    node->type = type;
+    node->out = node->out1 = node->tag = -1;
+    return parser->count++;
+}
+
+//adds chars first..last to a char set. inputs are printable, non-space
+static void regexAddRange(uint64_t* chars, int first, int last){
+    for (int c = first < 33 ? 33 : first; c <= last && c <= 126; c++){
+        chars[c / 64] |= 1ULL << (c % 64);
+    }
+}
+
+//reads one char of a pattern, or an escape like \d, into chars. returns
+//the char, or -1 for a class escape
+static int regexChar(RegexParser* parser, uint64_t* chars){
+    int c = (unsigned char)*parser->p++;
+    if (c == '\\'){
+        c = (unsigned char)*parser->p++;
+        if (c == 'd' || c == 'w'){
+            regexAddRange(chars, '0', '9');
+            if (c == 'w'){
+                regexAddRange(chars, 'a', 'z');
+                regexAddRange(chars, 'A', 'Z');
+                regexAddRange(chars, '_', '_');
+            }
+            return -1;
+        }
+    }
+    if (c < 33 || c > 126){
+        parser->error = c ? "inputs can only be printable, non-space chars"
+                          : "pattern ends in the middle of an escape or [";
+        parser->p -= !c; //stay on the end of the pattern
+        return -1;
+    }
+    regexAddRange(chars, c, c);
+    return c;
+}
+
+//a char, [class], . or (group)
+static RegexFragment regexAtom(RegexParser* parser){
+    char c = *parser->p;
+    RegexFragment fragment = {-1, -1};
+    if (c == '('){
+        parser->p++;
+        fragment = regexAlternation(parser);
+        if (*parser->p != ')'){
+            parser->error = parser->error ? parser->error : "missing )";
+            return fragment;
+        }
+        parser->p++;
+        return fragment;
+    }
+    if (c == '*' || c == '+' || c == '?'){
+        parser->error = "nothing to repeat";
+        return fragment;
+    }
+
+    uint64_t chars[2] = {0, 0};
+    if (c == '.'){
+        parser->p++;
+        regexAddRange(chars, 33, 126);
+    }
+    else if (c == '['){
+        parser->p++;
+        int negate = *parser->p == '^';
+        parser->p += negate;
+        while (!parser->error && *parser->p != ']'){
+            int first = regexChar(parser, chars);
+            if (first >= 0 && parser->p[0] == '-' && parser->p[1] != ']'){
+                parser->p++;
+                int last = regexChar(parser, chars);
+                if (last < first){
+                    parser->error = parser->error ? parser->error : "bad range in []";
+                }
+                regexAddRange(chars, first, last);
+            }
+        }
+        parser->p += !parser->error;
+        if (negate){
+            chars[0] = ~chars[0];
+            chars[1] = ~chars[1];
+            uint64_t printable[2] = {0, 0};
+            regexAddRange(printable, 33, 126);
+            chars[0] &= printable[0];
+            chars[1] &= printable[1];
+        }
+    }
+    else{
+        regexChar(parser, chars);
+    }
+    int node = regexNode(parser, REGEX_CHARS);
+    int end = regexNode(parser, REGEX_EMPTY);
+    parser->nodes[node].chars[0] = chars[0];
+    parser->nodes[node].chars[1] = chars[1];
+    parser->nodes[node].out = end;
+    fragment.start = node;
+    fragment.end = end;
+    return fragment;
+}
+
+//an atom followed by any number of *, + and ?
+static RegexFragment regexRepeat(RegexParser* parser){
+    RegexFragment fragment = regexAtom(parser);
+    while (!parser->error && (*parser->p == '*' || *parser->p == '+'
+                              || *parser->p == '?')){
+        char op = *parser->p++;
+        int split = regexNode(parser, REGEX_SPLIT);
+        int end = regexNode(parser, REGEX_EMPTY);
+        parser->nodes[split].out = fragment.start;
+        parser->nodes[split].out1 = end;
+        parser->nodes[fragment.end].out = op == '?' ? end : split;
+        fragment.start = op == '+' ? fragment.start : split;
+        fragment.end = end;
+    }
+    return fragment;
+}
+
+//repeats one after another, up to a | or ). may be empty
+static RegexFragment regexConcat(RegexParser* parser){
+    int empty = regexNode(parser, REGEX_EMPTY);
+    RegexFragment fragment = {empty, empty};
+    while (!parser->error && *parser->p && *parser->p != '|' && *parser->p != ')'){
+        RegexFragment next = regexRepeat(parser);
+        if (parser->error){
+            break;
+        }
+        parser->nodes[fragment.end].out = next.start;
+        fragment.end = next.end;
+    }
+    return fragment;
+}
+
+//concatenations separated by |
+static RegexFragment regexAlternation(RegexParser* parser){
+    RegexFragment fragment = regexConcat(parser);
+    while (!parser->error && *parser->p == '|'){
+        parser->p++;
+        RegexFragment other = regexConcat(parser);
+        int split = regexNode(parser, REGEX_SPLIT);
+        int end = regexNode(parser, REGEX_EMPTY);
+        parser->nodes[split].out = fragment.start;
+        parser->nodes[split].out1 = other.start;
+        parser->nodes[fragment.end].out = end;
+        parser->nodes[other.end].out = end;
+        fragment.start = split;
+        fragment.end = end;
+    }
+    return fragment;
+}
+
+//adds node and everything reachable from it by epsilon edges to set
+static void regexClosure(const RegexNode* nodes, uint64_t* set, int* stack, int node){
+    int top = 0;
+    if (set[node / 64] & (1ULL << (node % 64))){
+        return;
+    }
+    set[node / 64] |= 1ULL << (node % 64);
+    stack[top++] = node;
+    while (top > 0){
+        const RegexNode* n = &nodes[stack[--top]];
+        int outs[2] = {n->type == REGEX_SPLIT || n->type == REGEX_EMPTY ? n->out : -1,
+                       n->type == REGEX_SPLIT ? n->out1 : -1};
+        for (int k = 0; k < 2; k++){
+            if (outs[k] >= 0 && !(set[outs[k] / 64] & (1ULL << (outs[k] % 64)))){
+                set[outs[k] / 64] |= 1ULL << (outs[k] % 64);
+                stack[top++] = outs[k];
+            }
+        }
+    }
+}
+
+//gives each state of dfa a block number in newBlock, so that states share a
+//block only if they had the same block and, if withNext, go to the same
+//blocks on every input. returns the number of blocks
+static int regexRefine(const RegexDFA* dfa, const int* block, int* newBlock,
+                       int withNext){
+    int n = dfa->numStates;
+    int width = withNext ? 1 + dfa->numClasses : 1;
+    int hashCapacity = 16;
+    while (hashCapacity < 2 * n){
+        hashCapacity *= 2;
+    }
+    int* hash = malloc(sizeof(int) * hashCapacity); //first state of each block
+    int* signature = malloc(sizeof(int) * 2 * width);
+    int* other = signature + width;
+    for (int i = 0; i < hashCapacity; i++){
+        hash[i] = -1;
+    }
+    int blocks = 0;
+    for (int s = 0; s < n; s++){
+        signature[0] = block[s];
+        for (int c = 1; c < width; c++){
+            int next = dfa->next[(size_t)s * dfa->numClasses + c - 1];
+            signature[c] = next < 0 ? -1 : block[next];
+        }
+        uint64_t h = fnvHash(FNV_OFFSET, signature, sizeof(int) * width);
+        for (int slot = (int)(h & (hashCapacity - 1));; slot = (slot + 1) & (hashCapacity - 1)){
+            int r = hash[slot];
+            if (r < 0){
+                hash[slot] = s;
+                newBlock[s] = blocks++;
+                break;
+            }
+            other[0] = block[r];
+            for (int c = 1; c < width; c++){
+                int next = dfa->next[(size_t)r * dfa->numClasses + c - 1];
+                other[c] = next < 0 ? -1 : block[next];
+            }
+            if (!memcmp(signature, other, sizeof(int) * width)){
+                newBlock[s] = newBlock[r];
+                break;
+            }
+        }
+    }
+    free(hash);
+    free(signature);
+    return blocks;
+}
+
+//merges equivalent states (Moore's partition refinement) and numbers the
+//rest in breadth first order from the start state
+static RegexDFA* regexMinimize(const RegexDFA* dfa){
+    int n = dfa->numStates;
+    int classes = dfa->numClasses;
+    int* block = malloc(sizeof(int) * n);
+    int* newBlock = malloc(sizeof(int) * n);
+    int blocks = regexRefine(dfa, dfa->tag, block, 0);
+    for (;;){
+        int refined = regexRefine(dfa, block, newBlock, 1);
+        int* swap = block;
+        block = newBlock;
+        newBlock = swap;
+        if (refined == blocks){
+            break;
+        }
+        blocks = refined;
+    }
+
+    //first state in each block, then the order blocks are reached in
+    int* first = malloc(sizeof(int) * blocks);
+    int* order = malloc(sizeof(int) * blocks);
+    int* queue = malloc(sizeof(int) * blocks);
+    for (int b = 0; b < blocks; b++){
+        first[b] = order[b] = -1;
+    }
+    for (int s = n - 1; s >= 0; s--){
+        first[block[s]] = s;
+    }
+    int head = 0, tail = 0;
+    order[block[0]] = tail;
+    queue[tail++] = block[0];
+    while (head < tail){
+        int s = first[queue[head++]];
+        for (int c = 0; c < classes; c++){
+            int next = dfa->next[(size_t)s * classes + c];
+            if (next >= 0 && order[block[next]] < 0){
+                order[block[next]] = tail;
+                queue[tail++] = block[next];
+            }
+        }
+    }
+
+    RegexDFA* minimal = calloc(1, sizeof(RegexDFA));
+    minimal->numStates = tail;
+    minimal->numClasses = classes;
+    memcpy(minimal->classOf, dfa->classOf, sizeof(dfa->classOf));
+    minimal->next = malloc(sizeof(int) * ((size_t)tail * classes + 1));
+    minimal->tag = malloc(sizeof(int) * tail);
+    for (int k = 0; k < tail; k++){
+        int s = first[queue[k]];
+        minimal->tag[k] = dfa->tag[s];
+        for (int c = 0; c < classes; c++){
+            int next = dfa->next[(size_t)s * classes + c];
+            minimal->next[(size_t)k * classes + c] = next < 0 ? -1 : order[block[next]];
+        }
+    }
+    free(block);
+    free(newBlock);
+    free(first);
+    free(order);
+    free(queue);
+    return minimal;
+}
+
+//compiles patterns into one minimized DFA: each pattern is parsed into a
+//Thompson NFA, the NFAs are joined by epsilon edges from one start, and
+//the subset construction turns the result into a DFA. a DFA state accepts
+//the first pattern whose match node it contains. returns NULL and sets
+//error if a pattern is invalid or the DFA gets too big
+RegexDFA* compileRegexes(int count, const char** patterns, const char** error){
+    RegexParser parser = {malloc(sizeof(RegexNode) * 64), 0, 64, NULL, NULL};
+    int start = -1;
+    for (int i = count - 1; i >= 0 && !parser.error; i--){
+        parser.p = patterns[i];
+        RegexFragment fragment = regexAlternation(&parser);
+        if (!parser.error && *parser.p){
+            parser.error = "unmatched )";
+        }
+        if (parser.error){
+            break;
+        }
+        int match = regexNode(&parser, REGEX_MATCH);
+        parser.nodes[match].tag = i;
+        parser.nodes[fragment.end].out = match;
+        if (start < 0){
+            start = fragment.start;
+        }
+        else{
+            int split = regexNode(&parser, REGEX_SPLIT);
+            parser.nodes[split].out = fragment.start;
+            parser.nodes[split].out1 = start;
+            start = split;
+        }
+    }
+    if (parser.error){
+        *error = parser.error;
+        free(parser.nodes);
+        return NULL;
+    }
+    const RegexNode* nodes = parser.nodes;
+    int numNodes = parser.count;
+
+    //chars that are in the same char sets of every node behave the same,
+    //so split the chars used by some node into classes by membership
+    RegexDFA dfa = {0};
+    for (int c = 0; c < 128; c++){
+        dfa.classOf[c] = -1;
+    }
+    for (int k = 0; k < numNodes; k++){
+        if (nodes[k].type != REGEX_CHARS){
+            continue;
+        }
+        short split[128][2];
+        memset(split, -1, sizeof(split));
+        int classes = 0;
+        for (int c = 33; c <= 126; c++){
+            int member = (nodes[k].chars[c / 64] >> (c % 64)) & 1;
+            int old = dfa.classOf[c];
+            if (old < 0 && !member){
+                continue;
+            }
+            int key = old < 0 ? 127 : old;
+            if (split[key][member] < 0){
+                split[key][member] = (short)classes++;
+            }
+            dfa.classOf[c] = split[key][member];
+        }
+        dfa.numClasses = classes;
+    }
+    unsigned char classChar[128];
+    for (int c = 126; c >= 33; c--){
+        if (dfa.classOf[c] >= 0){
+            classChar[dfa.classOf[c]] = (unsigned char)c;
+        }
+    }
+
+    //subset construction, with each DFA state's NFA set in sets
+    int words = (numNodes + 63) / 64;
+    int capacity = 64, hashCapacity = 128;
+    uint64_t* sets = calloc((size_t)capacity * words, sizeof(uint64_t));
+    dfa.next = malloc(sizeof(int) * capacity * (dfa.numClasses + 1));
+    dfa.tag = malloc(sizeof(int) * capacity);
+    int* hash = malloc(sizeof(int) * hashCapacity);
+    for (int i = 0; i < hashCapacity; i++){
+        hash[i] = -1;
+    }
+    int* stack = malloc(sizeof(int) * numNodes);
+    uint64_t* set = malloc(sizeof(uint64_t) * words);
+    memset(set, 0, sizeof(uint64_t) * words);
+    regexClosure(nodes, set, stack, start);
+    *error = NULL;
+    for (int s = -1; s < dfa.numStates && !*error; s++){
+        for (int c = 0; c < (s < 0 ? 1 : dfa.numClasses); c++){
+            //s == -1 adds the start set, which is already in set
+            if (s >= 0){
+                memset(set, 0, sizeof(uint64_t) * words);
+                const uint64_t* from = sets + (size_t)s * words;
+                int ch = classChar[c];
+                for (int w = 0; w < words; w++){
+                    for (uint64_t bits = from[w]; bits; bits &= bits - 1){
+                        const RegexNode* node = &nodes[w * 64 + __builtin_ctzll(bits)];
+                        if (node->type == REGEX_CHARS
+                            && (node->chars[ch / 64] >> (ch % 64)) & 1){
+                            regexClosure(nodes, set, stack, node->out);
+                        }
+                    }
+                }
+                int empty = 1;
+                for (int w = 0; w < words && empty; w++){
+                    empty = !set[w];
+                }
+                if (empty){
+                    dfa.next[(size_t)s * dfa.numClasses + c] = -1;
+                    continue;
+                }
+            }
+
+            //find the set, or add it as a new DFA state
+            uint64_t h = fnvHash(FNV_OFFSET, set, sizeof(uint64_t) * words);
+            int slot = (int)(h & (hashCapacity - 1));
+            while (hash[slot] >= 0 && memcmp(sets + (size_t)hash[slot] * words, set,
+                                             sizeof(uint64_t) * words)){
+                slot = (slot + 1) & (hashCapacity - 1);
+            }
+            int target = hash[slot];
+            if (target < 0){
+                if (dfa.numStates == REGEX_MAX_STATES){
+                    *error = "patterns need too many states";
+                    break;
+                }
+                if (dfa.numStates == capacity){
+                    capacity *= 2;
+                    sets = realloc(sets, sizeof(uint64_t) * capacity * words);
+                    dfa.next = realloc(dfa.next, sizeof(int) * capacity
+                                                 * (dfa.numClasses + 1));
+                    dfa.tag = realloc(dfa.tag, sizeof(int) * capacity);
+                }
+                target = dfa.numStates++;
+                memcpy(sets + (size_t)target * words, set, sizeof(uint64_t) * words);
+                dfa.tag[target] = -1;
+                for (int k = 0; k < numNodes; k++){
+                    if (nodes[k].type == REGEX_MATCH && (set[k / 64] >> (k % 64)) & 1
+                        && (dfa.tag[target] < 0 || nodes[k].tag < dfa.tag[target])){
+                        dfa.tag[target] = nodes[k].tag;
+                    }
+                }
+                hash[slot] = target;
+                //keep the hash table at most half full
+                if (2 * dfa.numStates > hashCapacity){
+                    hashCapacity *= 2;
+                    hash = realloc(hash, sizeof(int) * hashCapacity);
+                    for (int i = 0; i < hashCapacity; i++){
+                        hash[i] = -1;
+                    }
+                    for (int d = 0; d < dfa.numStates; d++){
+                        uint64_t dh = fnvHash(FNV_OFFSET, sets + (size_t)d * words,
+                                              sizeof(uint64_t) * words);
+                        int ds = (int)(dh & (hashCapacity - 1));
+                        while (hash[ds] >= 0){
+                            ds = (ds + 1) & (hashCapacity - 1);
+                        }
+                        hash[ds] = d;
+                    }
+                }
+            }
+            if (s >= 0){
+                dfa.next[(size_t)s * dfa.numClasses + c] = target;
+            }
+        }
+    }
+    free(sets);
+    free(hash);
+    free(stack);
+    free(set);
+    free(parser.nodes);
+    RegexDFA* minimal = *error ? NULL : regexMinimize(&dfa);
+    free(dfa.next);
+    free(dfa.tag);
+    return minimal;
+}
+
+void freeRegexDFA(RegexDFA* dfa){
+    free(dfa->next);
+    free(dfa->tag);
+    free(dfa);
+}
+
+//lists the DFA's transitions in the definition file's parallel arrays.
+//returns how many there are
+int regexTransitions(const RegexDFA* dfa, int** curStateList, char** inputList,
+                     int** nextStateList){
+    int length = 0;
+    for (int pass = 0; pass < 2; pass++){
+        if (pass){
+            *curStateList = malloc(sizeof(int) * (length ? length : 1));
+            *inputList = malloc(length ? length : 1);
+            *nextStateList = malloc(sizeof(int) * (length ? length : 1));
+            length = 0;
+        }
+        for (int s = 0; s < dfa->numStates; s++){
+            for (int c = 33; c <= 126; c++){
+                int cls = dfa->classOf[c];
+                int next = cls < 0 ? -1 : dfa->next[(size_t)s * dfa->numClasses + cls];
+                if (next >= 0){
+                    if (pass){
+                        (*curStateList)[length] = s;
+                        (*inputList)[length] = (char)c;
+                        (*nextStateList)[length] = next;
+                    }
+                    length++;
+                }
+            }
+        }
+    }
+    return length;
+}
+
+//writes the DFA as a definition file into a new buffer. states that
+//accept a tagged pattern get that tag as their output, one per line
+char* regexDefinition(const RegexDFA* dfa, const char** tags, size_t* size){
+    char* text = NULL;
+    FILE* out = open_memstream(&text, size);
+    int* curStateList;
+    char* inputList;
+    int* nextStateList;
+    int length = regexTransitions(dfa, &curStateList, &inputList, &nextStateList);
+    for (int i = 0; i < length; i++){
+        fprintf(out, "%d:%c>%d\n", curStateList[i], inputList[i], nextStateList[i]);
+    }
+    for (int s = 0; s < dfa->numStates; s++){
+        if (dfa->tag[s] >= 0 && tags[dfa->tag[s]]){
+            fprintf(out, "%d/%s\\n\n", s, tags[dfa->tag[s]]);
+        }
+    }
+    fclose(out);
+    free(curStateList);
+    free(inputList);
+    free(nextStateList);
+    return text;
+}
+
+//starts a run at the table's start state. touches every page of the table
+//so steps don't take page faults, and if lock is set tries to lock it in
+//memory until realtimeFree
+void realtimeInit(RealtimeRun* run, const FSMTable* table, int lock){
+    run->table = table;
+    run->state = table->start;
+    run->status = RUN_OK;
+    run->badInput = 0;
+    run->steps = 0;
+    size_t cells = (size_t)(table->numStates + 1) * table->numClasses;
+    //fails without permission, that's fine
+    run->locked = lock && mlock(table->next, sizeof(int) * cells) == 0;
+    volatile int sum = 0;
+    for (size_t i = 0; i < cells; i += 4096 / sizeof(int)){
+        sum += table->next[i];
+    }
+    (void)sum;
+}
+
+//unlocks the table if realtimeInit locked it. call before freeing the table
+void realtimeFree(RealtimeRun* run){
+    if (run->locked){
+        const FSMTable* table = run->table;
+        munlock(table->next,
+                sizeof(int) * (size_t)(table->numStates + 1) * table->numClasses);
+        run->locked = 0;
+    }
+}
+
+//moves the run one event forward. returns the run's status
+int realtimeStep(RealtimeRun* run, char input){
+    if (run->status != RUN_OK){
+        return run->status;
+    }
+    const FSMTable* table = run->table;
+    int cls = table->classOf[(unsigned char)input];
+    int nextState = cls < 0 ? table->dead
+                            : table->next[(size_t)run->state * table->numClasses + cls];
+    if (nextState == table->dead){
+        run->status = cls < 0 ? RUN_INVALID_INPUT : RUN_DEAD_END;
+        run->badInput = input;
+        return run->status;
+    }
+    run->state = nextState;
+    run->steps++;
+    return RUN_OK;
+}
+
+//a timestamp for latency measurements: the time stamp counter where there
+//is one, else nanoseconds. the fences keep the step being timed from
+//running before or after the reads
+uint64_t latencyTicks(){
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t ticks = __rdtsc();
+    _mm_lfence();
+    return ticks;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+//how many latencyTicks make a nanosecond, measured against the clock
+double latencyTicksPerNs(){
+    double begin = seconds();
+    uint64_t ticks = latencyTicks();
+    while (seconds() - begin < 0.02){
+    }
+    return (latencyTicks() - ticks) / ((seconds() - begin) * 1e9);
+}
+
+static int compareTicks(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+//sorts the measured latencies and prints their percentiles in ns
+void printLatencies(const char* name, uint64_t* ticks, long long count,
+                    double ticksPerNs){
+    if (count == 0){
+        printf("%s: no steps\n", name);
+        return;
+    }
+    qsort(ticks, count, sizeof(uint64_t), compareTicks);
+    printf("%s: p50 %6.1f ns, p99 %6.1f ns, p99.9 %7.1f ns, max %8.1f ns\n", name,
+           ticks[count / 2] / ticksPerNs, ticks[count * 99 / 100] / ticksPerNs,
+           ticks[count * 999 / 1000] / ticksPerNs, ticks[count - 1] / ticksPerNs);
+}
+
+//per-event latency of realtimeStep on random machines, from ones that fit
+//in cache to ones much larger than the last level cache, and of the
+//linear scan getState and moveOne use
+void benchLatency(){
+    const int sizes[] = {16, 1024, 65536, 1 << 20};
+    int numInputs = 16;
+    long long events = 2000000;
+    char* inputs = malloc(events);
+    uint64_t* ticks = malloc(sizeof(uint64_t) * events);
+    unsigned long long seed = 37;
+    for (long long k = 0; k < events; k++){
+        inputs[k] = (char)('a' + rngNext(&seed) % numInputs);
+    }
+    double ticksPerNs = latencyTicksPerNs();
+    uint64_t overhead = latencyTicks();
+    overhead = latencyTicks() - overhead;
+    printf("latency benchmark: %d inputs, %lld events, timer overhead %.1f ns\n",
+           numInputs, events, overhead / ticksPerNs);
+
+    for (int n = 0; n < 4; n++){
+        int numStates = sizes[n];
+        int length = numStates * numInputs;
+        int* curStateList = malloc(sizeof(int) * length);
+        char* inputList = malloc(length);
+        int* nextStateList = malloc(sizeof(int) * length);
+        generateFSM(numStates, numInputs, 41, curStateList, inputList, nextStateList);
+        FSMTable* table = compileFSM(length, curStateList, inputList, nextStateList);
+        RealtimeRun run;
+        realtimeInit(&run, table, 1);
+        for (long long k = 0; k < events; k++){
+            uint64_t begin = latencyTicks();
+            realtimeStep(&run, inputs[k]);
+            ticks[k] = latencyTicks() - begin;
+        }
+        realtimeFree(&run);
+        char name[64];
+        snprintf(name, sizeof(name), "realtimeStep %7d states", numStates);
+        printLatencies(name, ticks, events, ticksPerNs);
+
+        //the linear scan, on fewer events since each one can scan the file
+        if (numStates <= 1024){
+            long long scanEvents = numStates <= 16 ? events : events / 20;
+            int state = 0, status;
+            for (long long k = 0; k < scanEvents; k++){
+                uint64_t begin = latencyTicks();
+                state = scanStep(length, curStateList, inputList, nextStateList,
+                                 inputs[k], state, &status);
+                ticks[k] = latencyTicks() - begin;
+            }
+            snprintf(name, sizeof(name), "linear scan  %7d states", numStates);
+            printLatencies(name, ticks, scanEvents, ticksPerNs);
+        }
+        freeFSMTable(table);
+        free(curStateList);
+        free(inputList);
+        free(nextStateList);
+    }
+    free(inputs);
+    free(ticks);
 }